@@ -0,0 +1,396 @@
+#include "aescbc.h"
+#include <stdatomic.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define AESCBC_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#define AESCBC_ARM
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#define AESCBC_ROUNDS 14
+#define AESCBC_LANES 8 // blocks decrypted together; CBC decryption has no dependency between blocks
+
+typedef uint8_t AesBackend;
+enum AesBackend {
+	AesBackend_Mbedtls,
+	AesBackend_AesNi,
+	AesBackend_Vaes, // AES-NI, with decryption running two blocks per instruction
+	AesBackend_ArmCrypto,
+};
+
+static const char *const AesBackend_ToString[] = {"mbedtls", "AES-NI", "VAES", "ARMv8 Crypto"};
+
+static const uint8_t AesSbox[256] = {
+	0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+	0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+	0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+	0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+	0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+	0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+	0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+	0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16,
+};
+
+// FIPS-197 key expansion, laid out as the round keys both AES-NI and the ARMv8 instructions consume
+static void AesCbc_expand(const uint8_t key[static 32], uint8_t roundKeys[static AESCBC_ROUNDS + 1][16]) {
+	uint8_t *w = roundKeys[0], rcon = 1;
+	memcpy(w, key, 32);
+	for(uint32_t i = 8; i < 4 * (AESCBC_ROUNDS + 1); ++i) {
+		uint8_t t[4];
+		memcpy(t, &w[(i - 1) * 4], sizeof(t));
+		if(i % 8 == 0) {
+			uint8_t first = t[0];
+			t[0] = AesSbox[t[1]] ^ rcon;
+			t[1] = AesSbox[t[2]];
+			t[2] = AesSbox[t[3]];
+			t[3] = AesSbox[first];
+			rcon = (uint8_t)(rcon << 1 ^ ((rcon >> 7) * 0x1b));
+		} else if(i % 8 == 4) {
+			for(uint32_t j = 0; j < 4; ++j)
+				t[j] = AesSbox[t[j]];
+		}
+		for(uint32_t j = 0; j < 4; ++j)
+			w[i * 4 + j] = w[(i - 8) * 4 + j] ^ t[j];
+	}
+}
+
+#ifdef AESCBC_X86
+[[gnu::target("aes")]] static void AesNi_invert(uint8_t roundKeys[static AESCBC_ROUNDS + 1][16]) {
+	__m128i k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = _mm_load_si128((const __m128i*)roundKeys[r]);
+	_mm_store_si128((__m128i*)roundKeys[0], k[AESCBC_ROUNDS]);
+	for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+		_mm_store_si128((__m128i*)roundKeys[r], _mm_aesimc_si128(k[AESCBC_ROUNDS - r]));
+	_mm_store_si128((__m128i*)roundKeys[AESCBC_ROUNDS], k[0]);
+}
+
+[[gnu::target("aes")]] static void AesNi_encrypt(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	__m128i k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = _mm_load_si128((const __m128i*)roundKeys[r]);
+	__m128i block = _mm_loadu_si128((const __m128i*)iv);
+	for(size_t i = 0; i < length; i += 16) {
+		block = _mm_xor_si128(block, _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[i]), k[0]));
+		for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+			block = _mm_aesenc_si128(block, k[r]);
+		block = _mm_aesenclast_si128(block, k[AESCBC_ROUNDS]);
+		_mm_storeu_si128((__m128i*)&out[i], block);
+	}
+	_mm_storeu_si128((__m128i*)iv, block);
+}
+
+// Decrypts the blocks which don't fill a whole group of lanes
+[[gnu::target("aes")]] static __m128i AesNi_decrypt_serial(const __m128i k[static AESCBC_ROUNDS + 1], __m128i prev, size_t length, const uint8_t *in, uint8_t *out) {
+	for(size_t i = 0; i < length; i += 16) {
+		__m128i cipher = _mm_loadu_si128((const __m128i*)&in[i]), block = _mm_xor_si128(cipher, k[0]);
+		for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+			block = _mm_aesdec_si128(block, k[r]);
+		_mm_storeu_si128((__m128i*)&out[i], _mm_xor_si128(_mm_aesdeclast_si128(block, k[AESCBC_ROUNDS]), prev));
+		prev = cipher;
+	}
+	return prev;
+}
+
+[[gnu::target("aes")]] static void AesNi_decrypt(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	__m128i k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = _mm_load_si128((const __m128i*)roundKeys[r]);
+	__m128i prev = _mm_loadu_si128((const __m128i*)iv);
+	size_t i = 0;
+	for(; i + 16 * AESCBC_LANES <= length; i += 16 * AESCBC_LANES) {
+		__m128i cipher[AESCBC_LANES], block[AESCBC_LANES];
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j) {
+			cipher[j] = _mm_loadu_si128((const __m128i*)&in[i + 16 * j]);
+			block[j] = _mm_xor_si128(cipher[j], k[0]);
+		}
+		for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+			#pragma GCC unroll 8
+			for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+				block[j] = _mm_aesdec_si128(block[j], k[r]);
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j) // every block is read before the first store, so `out` may alias `in`
+			_mm_storeu_si128((__m128i*)&out[i + 16 * j], _mm_xor_si128(_mm_aesdeclast_si128(block[j], k[AESCBC_ROUNDS]), j ? cipher[j - 1] : prev));
+		prev = cipher[AESCBC_LANES - 1];
+	}
+	_mm_storeu_si128((__m128i*)iv, AesNi_decrypt_serial(k, prev, length - i, &in[i], &out[i]));
+}
+
+[[gnu::target("aes,avx2,vaes")]] static void Vaes_decrypt(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	__m128i k[AESCBC_ROUNDS + 1];
+	__m256i k2[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r) {
+		k[r] = _mm_load_si128((const __m128i*)roundKeys[r]);
+		k2[r] = _mm256_broadcastsi128_si256(k[r]);
+	}
+	__m128i prev = _mm_loadu_si128((const __m128i*)iv);
+	size_t i = 0;
+	for(; i + 16 * AESCBC_LANES <= length; i += 16 * AESCBC_LANES) {
+		__m256i block[AESCBC_LANES / 2], chain[AESCBC_LANES / 2];
+		chain[0] = _mm256_set_m128i(_mm_loadu_si128((const __m128i*)&in[i]), prev);
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES / 2; ++j) {
+			block[j] = _mm256_loadu_si256((const __m256i*)&in[i + 32 * j]);
+			if(j)
+				chain[j] = _mm256_loadu_si256((const __m256i*)&in[i + 32 * j - 16]);
+		}
+		prev = _mm_loadu_si128((const __m128i*)&in[i + 16 * (AESCBC_LANES - 1)]);
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES / 2; ++j)
+			block[j] = _mm256_xor_si256(block[j], k2[0]);
+		for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+			#pragma GCC unroll 8
+			for(uint32_t j = 0; j < AESCBC_LANES / 2; ++j)
+				block[j] = _mm256_aesdec_epi128(block[j], k2[r]);
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES / 2; ++j) // all loads above happen before the first store, so `out` may alias `in`
+			_mm256_storeu_si256((__m256i*)&out[i + 32 * j], _mm256_xor_si256(_mm256_aesdeclast_epi128(block[j], k2[AESCBC_ROUNDS]), chain[j]));
+	}
+	_mm_storeu_si128((__m128i*)iv, AesNi_decrypt_serial(k, prev, length - i, &in[i], &out[i]));
+}
+
+// Encrypts independent blocks, `AESCBC_LANES` at a time; `out` may alias `in`
+[[gnu::target("aes")]] static void AesNi_ecb(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, const uint8_t *in, uint8_t *out) {
+	__m128i k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = _mm_load_si128((const __m128i*)roundKeys[r]);
+	size_t i = 0;
+	for(; i + 16 * AESCBC_LANES <= length; i += 16 * AESCBC_LANES) {
+		__m128i block[AESCBC_LANES];
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+			block[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[i + 16 * j]), k[0]);
+		for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+			#pragma GCC unroll 8
+			for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+				block[j] = _mm_aesenc_si128(block[j], k[r]);
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+			_mm_storeu_si128((__m128i*)&out[i + 16 * j], _mm_aesenclast_si128(block[j], k[AESCBC_ROUNDS]));
+	}
+	for(; i < length; i += 16) {
+		__m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[i]), k[0]);
+		for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+			block = _mm_aesenc_si128(block, k[r]);
+		_mm_storeu_si128((__m128i*)&out[i], _mm_aesenclast_si128(block, k[AESCBC_ROUNDS]));
+	}
+}
+#endif
+
+#ifdef AESCBC_ARM
+[[gnu::target("+crypto")]] static void ArmCrypto_invert(uint8_t roundKeys[static AESCBC_ROUNDS + 1][16]) {
+	uint8x16_t k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = vld1q_u8(roundKeys[r]);
+	vst1q_u8(roundKeys[0], k[AESCBC_ROUNDS]);
+	for(uint32_t r = 1; r < AESCBC_ROUNDS; ++r)
+		vst1q_u8(roundKeys[r], vaesimcq_u8(k[AESCBC_ROUNDS - r]));
+	vst1q_u8(roundKeys[AESCBC_ROUNDS], k[0]);
+}
+
+// AESE/AESD apply the round key before SubBytes, so the final key is a plain XOR
+[[gnu::target("+crypto")]] static void ArmCrypto_encrypt(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	uint8x16_t k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = vld1q_u8(roundKeys[r]);
+	uint8x16_t block = vld1q_u8(iv);
+	for(size_t i = 0; i < length; i += 16) {
+		block = veorq_u8(block, vld1q_u8(&in[i]));
+		for(uint32_t r = 0; r < AESCBC_ROUNDS - 1; ++r)
+			block = vaesmcq_u8(vaeseq_u8(block, k[r]));
+		block = veorq_u8(vaeseq_u8(block, k[AESCBC_ROUNDS - 1]), k[AESCBC_ROUNDS]);
+		vst1q_u8(&out[i], block);
+	}
+	vst1q_u8(iv, block);
+}
+
+[[gnu::target("+crypto")]] static void ArmCrypto_decrypt(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	uint8x16_t k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = vld1q_u8(roundKeys[r]);
+	uint8x16_t prev = vld1q_u8(iv);
+	size_t i = 0;
+	for(; i + 16 * AESCBC_LANES <= length; i += 16 * AESCBC_LANES) {
+		uint8x16_t cipher[AESCBC_LANES], block[AESCBC_LANES];
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+			block[j] = cipher[j] = vld1q_u8(&in[i + 16 * j]);
+		for(uint32_t r = 0; r < AESCBC_ROUNDS - 1; ++r)
+			#pragma GCC unroll 8
+			for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+				block[j] = vaesimcq_u8(vaesdq_u8(block[j], k[r]));
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+			vst1q_u8(&out[i + 16 * j], veorq_u8(veorq_u8(vaesdq_u8(block[j], k[AESCBC_ROUNDS - 1]), k[AESCBC_ROUNDS]), j ? cipher[j - 1] : prev));
+		prev = cipher[AESCBC_LANES - 1];
+	}
+	for(; i < length; i += 16) {
+		uint8x16_t cipher = vld1q_u8(&in[i]), block = cipher;
+		for(uint32_t r = 0; r < AESCBC_ROUNDS - 1; ++r)
+			block = vaesimcq_u8(vaesdq_u8(block, k[r]));
+		vst1q_u8(&out[i], veorq_u8(veorq_u8(vaesdq_u8(block, k[AESCBC_ROUNDS - 1]), k[AESCBC_ROUNDS]), prev));
+		prev = cipher;
+	}
+	vst1q_u8(iv, prev);
+}
+
+[[gnu::target("+crypto")]] static void ArmCrypto_ecb(const uint8_t roundKeys[static AESCBC_ROUNDS + 1][16], size_t length, const uint8_t *in, uint8_t *out) {
+	uint8x16_t k[AESCBC_ROUNDS + 1];
+	for(uint32_t r = 0; r <= AESCBC_ROUNDS; ++r)
+		k[r] = vld1q_u8(roundKeys[r]);
+	size_t i = 0;
+	for(; i + 16 * AESCBC_LANES <= length; i += 16 * AESCBC_LANES) {
+		uint8x16_t block[AESCBC_LANES];
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+			block[j] = vld1q_u8(&in[i + 16 * j]);
+		for(uint32_t r = 0; r < AESCBC_ROUNDS - 1; ++r)
+			#pragma GCC unroll 8
+			for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+				block[j] = vaesmcq_u8(vaeseq_u8(block[j], k[r]));
+		#pragma GCC unroll 8
+		for(uint32_t j = 0; j < AESCBC_LANES; ++j)
+			vst1q_u8(&out[i + 16 * j], veorq_u8(vaeseq_u8(block[j], k[AESCBC_ROUNDS - 1]), k[AESCBC_ROUNDS]));
+	}
+	for(; i < length; i += 16) {
+		uint8x16_t block = vld1q_u8(&in[i]);
+		for(uint32_t r = 0; r < AESCBC_ROUNDS - 1; ++r)
+			block = vaesmcq_u8(vaeseq_u8(block, k[r]));
+		vst1q_u8(&out[i], veorq_u8(vaeseq_u8(block, k[AESCBC_ROUNDS - 1]), k[AESCBC_ROUNDS]));
+	}
+}
+#endif
+
+static AesBackend AesCbc_detect(void) {
+	#ifdef AESCBC_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("aes")) {
+		if(__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2"))
+			return AesBackend_Vaes;
+		return AesBackend_AesNi;
+	}
+	#elif defined(AESCBC_ARM)
+	if(getauxval(AT_HWCAP) & HWCAP_AES)
+		return AesBackend_ArmCrypto;
+	#endif
+	return AesBackend_Mbedtls;
+}
+
+static AesBackend AesCbc_selected(void) {
+	static _Atomic int32_t selected = -1; // benign race: every thread detects the same answer
+	int32_t backend = atomic_load_explicit(&selected, memory_order_relaxed);
+	if(backend < 0) {
+		backend = AesCbc_detect();
+		atomic_store_explicit(&selected, backend, memory_order_relaxed);
+	}
+	return (AesBackend)backend;
+}
+
+const char *AesCbc_backend(void) {
+	return AesBackend_ToString[AesCbc_selected()];
+}
+
+bool AesCbc_init(struct AesCbc *aes, const uint8_t key[static 32], bool decrypt) {
+	mbedtls_aes_init(&aes->fallback);
+	aes->backend = AesCbc_selected();
+	aes->decrypt = decrypt;
+	if((decrypt ? mbedtls_aes_setkey_dec : mbedtls_aes_setkey_enc)(&aes->fallback, key, 256))
+		return true;
+	AesCbc_expand(key, aes->roundKeys);
+	if(decrypt) {
+		switch(aes->backend) {
+			#ifdef AESCBC_X86
+			case AesBackend_AesNi: case AesBackend_Vaes: AesNi_invert(aes->roundKeys); break;
+			#endif
+			#ifdef AESCBC_ARM
+			case AesBackend_ArmCrypto: ArmCrypto_invert(aes->roundKeys); break;
+			#endif
+			default:;
+		}
+	}
+	return false;
+}
+
+void AesCbc_free(struct AesCbc *aes) {
+	mbedtls_aes_free(&aes->fallback);
+	memset(aes->roundKeys, 0, sizeof(aes->roundKeys));
+}
+
+static bool AesCbc_crypt_mbedtls(struct AesCbc *aes, size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	return mbedtls_aes_crypt_cbc(&aes->fallback, aes->decrypt ? MBEDTLS_AES_DECRYPT : MBEDTLS_AES_ENCRYPT, length, iv, in, out) != 0;
+}
+
+bool AesCbc_crypt(struct AesCbc *aes, size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out) {
+	if(length % 16)
+		return true;
+	#ifdef DEBUG
+	uint8_t expected[1536], expectedIv[16];
+	bool check = (aes->backend != AesBackend_Mbedtls && length <= sizeof(expected));
+	if(check) {
+		memcpy(expectedIv, iv, sizeof(expectedIv));
+		if(AesCbc_crypt_mbedtls(aes, length, expectedIv, in, expected))
+			return true;
+	}
+	#endif
+	switch(aes->backend) {
+		#ifdef AESCBC_X86
+		case AesBackend_AesNi: (aes->decrypt ? AesNi_decrypt : AesNi_encrypt)(aes->roundKeys, length, iv, in, out); break;
+		case AesBackend_Vaes: (aes->decrypt ? Vaes_decrypt : AesNi_encrypt)(aes->roundKeys, length, iv, in, out); break;
+		#endif
+		#ifdef AESCBC_ARM
+		case AesBackend_ArmCrypto: (aes->decrypt ? ArmCrypto_decrypt : ArmCrypto_encrypt)(aes->roundKeys, length, iv, in, out); break;
+		#endif
+		default: return AesCbc_crypt_mbedtls(aes, length, iv, in, out);
+	}
+	#ifdef DEBUG
+	if(check && (memcmp(out, expected, length) || memcmp(iv, expectedIv, sizeof(expectedIv)))) {
+		uprintf("%s AES-CBC %s mismatch\n", AesBackend_ToString[aes->backend], aes->decrypt ? "decrypt" : "encrypt");
+		return true;
+	}
+	#endif
+	return false;
+}
+
+bool AesCbc_keystream(struct AesCbc *aes, uint8_t counter[restrict static 16], size_t length, uint8_t *out) {
+	if(aes->decrypt || length % 16)
+		return true;
+	if(aes->backend == AesBackend_Mbedtls) {
+		uint8_t stream[16];
+		size_t offset = 0;
+		memset(out, 0, length);
+		return mbedtls_aes_crypt_ctr(&aes->fallback, length, &offset, counter, stream, out, out) != 0;
+	}
+	#ifdef DEBUG
+	uint8_t expected[1536], expectedCounter[16], stream[16];
+	size_t check = (length < sizeof(expected)) ? length : sizeof(expected), offset = 0;
+	memcpy(expectedCounter, counter, sizeof(expectedCounter));
+	memset(expected, 0, check);
+	if(mbedtls_aes_crypt_ctr(&aes->fallback, check, &offset, expectedCounter, stream, expected, expected))
+		return true;
+	#endif
+	for(size_t i = 0; i < length; i += 16) {
+		memcpy(&out[i], counter, 16);
+		for(uint32_t b = 16; b-- && !++counter[b];); // big-endian increment
+	}
+	switch(aes->backend) {
+		#ifdef AESCBC_X86
+		case AesBackend_AesNi: case AesBackend_Vaes: AesNi_ecb(aes->roundKeys, length, out, out); break;
+		#endif
+		#ifdef AESCBC_ARM
+		case AesBackend_ArmCrypto: ArmCrypto_ecb(aes->roundKeys, length, out, out); break;
+		#endif
+		default:;
+	}
+	#ifdef DEBUG
+	if(memcmp(out, expected, check) || (check == length && memcmp(counter, expectedCounter, sizeof(expectedCounter)))) {
+		uprintf("%s AES-CTR keystream mismatch\n", AesBackend_ToString[aes->backend]);
+		return true;
+	}
+	#endif
+	return false;
+}
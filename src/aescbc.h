@@ -0,0 +1,19 @@
+#pragma once
+#include "global.h"
+#include <mbedtls/aes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// AES-256-CBC in one direction, using the CPU's AES instructions when available and mbedtls otherwise
+struct AesCbc {
+	mbedtls_aes_context fallback;
+	_Alignas(16) uint8_t roundKeys[15][16]; // hardware schedule; the equivalent inverse cipher's for decryption
+	uint8_t backend;
+	bool decrypt;
+};
+
+bool AesCbc_init(struct AesCbc *aes, const uint8_t key[static 32], bool decrypt);
+void AesCbc_free(struct AesCbc *aes);
+bool AesCbc_crypt(struct AesCbc *aes, size_t length, uint8_t iv[restrict static 16], const uint8_t *in, uint8_t *out); // `length` must be a multiple of 16; `out` may alias `in`. `iv` is left at the last ciphertext block, like `mbedtls_aes_crypt_cbc()`.
+bool AesCbc_keystream(struct AesCbc *aes, uint8_t counter[restrict static 16], size_t length, uint8_t *out); // AES-CTR keystream from an encrypting context; `counter` is big-endian and advanced like `mbedtls_aes_crypt_ctr()` does. `length` must be a multiple of 16.
+const char *AesCbc_backend(void);
@@ -1,6 +1,7 @@
 #include "global.h"
 #include "config.h"
 #include "json.h"
+#include "net.h"
 #include <mbedtls/entropy.h>
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/error.h>
@@ -147,8 +148,17 @@ bool config_load(struct Config *out, const char *path) {
 	mbedtls_pk_init(&out->keys[1]);
 	out->wireKey_len = 0;
 	out->instanceCount = GetCoreCount();
+	out->instanceShards = 1;
 	out->masterPort = 2328;
 	out->statusPort = 0;
+	out->netRecvBatch = NET_RECV_BATCH_DEFAULT;
+	out->netUring = false;
+	out->netGro = false;
+	out->netPinger = false;
+	out->netPingRate = NET_PING_RATE_DEFAULT;
+	out->netRecvBuffer = 0;
+	out->netSendBuffer = 0;
+	out->netAutoTune = false;
 	*out->instanceAddress[0] = 0;
 	*out->instanceAddress[1] = 0;
 	*out->instanceParent = 0;
@@ -230,6 +240,7 @@ bool config_load(struct Config *out, const char *path) {
 			case JSON_KEY('m','a','s','t','e','r'): config_read_string(&it, key, out->instanceParent); break;
 			case JSON_KEY('m','a','p','P','o','o','l'): config_read_string(&it, key, out->instanceMapPool); break;
 			case JSON_KEY('c','o','u','n','t'): config_read_uint16(&it, key, 0, 8192, &out->instanceCount); break;
+			case JSON_KEY('s','h','a','r','d','s'): config_read_uint16(&it, key, 1, 64, &out->instanceShards); break;
 			default: json_skip_any(&it);
 		} break;
 		case JSON_KEY('m','a','s','t','e','r'): enableMaster = true; JSON_ITER_OBJECT(&it) {
@@ -244,6 +255,17 @@ bool config_load(struct Config *out, const char *path) {
 			case JSON_KEY('k','e','y'): config_read_pk(&it, key, &ctr_drbg, &out->statusKey); break;
 			default: json_skip_any(&it);
 		} break;
+		case JSON_KEY('n','e','t'): JSON_ITER_OBJECT(&it) {
+			case JSON_KEY('b','a','t','c','h'): config_read_uint16(&it, key, 1, NET_RECV_BATCH_MAX, &out->netRecvBatch); break;
+			case JSON_KEY('u','r','i','n','g'): out->netUring = json_read_bool(&it); break;
+			case JSON_KEY('g','r','o'): out->netGro = json_read_bool(&it); break;
+			case JSON_KEY('p','i','n','g','e','r'): out->netPinger = json_read_bool(&it); break;
+			case JSON_KEY('p','i','n','g','R','a','t','e'): config_read_uint16(&it, key, 0, UINT16_MAX, &out->netPingRate); break;
+			case JSON_KEY('r','c','v','b','u','f'): config_read_uint16(&it, key, 0, UINT16_MAX, &out->netRecvBuffer); break;
+			case JSON_KEY('s','n','d','b','u','f'): config_read_uint16(&it, key, 0, UINT16_MAX, &out->netSendBuffer); break;
+			case JSON_KEY('a','u','t','o','T','u','n','e'): out->netAutoTune = json_read_bool(&it); break;
+			default: json_skip_any(&it);
+		} break;
 		default: json_skip_any(&it);
 	}
 	if(json_is_error(it))
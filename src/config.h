@@ -18,7 +18,10 @@ struct Config {
 	};
 	uint8_t wireKey_len;
 	uint8_t wireKey[32];
-	uint16_t instanceCount, masterPort, statusPort;
+	uint16_t instanceCount, instanceShards, masterPort, statusPort;
+	uint16_t netRecvBatch, netPingRate;
+	uint16_t netRecvBuffer, netSendBuffer; // KiB
+	bool netUring, netGro, netPinger, netAutoTune;
 	char instanceAddress[2][CONFIG_STRING_LENGTH];
 	char instanceParent[CONFIG_STRING_LENGTH];
 	char instanceMapPool[CONFIG_STRING_LENGTH];
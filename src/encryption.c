@@ -3,7 +3,6 @@
 #include "encryption.h"
 #include <mbedtls/ssl.h>
 #include <mbedtls/error.h>
-#include <mbedtls/sha256.h>
 
 static uint32_t min32(uint32_t a, uint32_t b) {
 	return a < b ? a : b;
@@ -28,6 +27,11 @@ static void PRF(uint8_t out[restrict static 510], uint8_t out_len, uint8_t *key,
 	}
 }
 
+static void EncryptionState_release(struct EncryptionState *state) {
+	AesCbc_free(&state->encryptAes);
+	AesCbc_free(&state->decryptAes);
+}
+
 bool EncryptionState_init(struct EncryptionState *state, const mbedtls_mpi *secret, const struct Cookie32 random[static 2], bool client) {
 	if(!mbedtls_md_info_from_type(MBEDTLS_MD_SHA256)) {
 		uprintf("mbedtls_md_info_from_type(MBEDTLS_MD_SHA256) failed\n");
@@ -53,15 +57,23 @@ bool EncryptionState_init(struct EncryptionState *state, const mbedtls_mpi *secr
 	state->outboundSequence = ~0u;
 	state->receiveWindowEnd = 0;
 	state->receiveWindow = 0;
-	mbedtls_aes_init(&state->aes);
+	if(AesCbc_init(&state->encryptAes, state->sendKey, false) | AesCbc_init(&state->decryptAes, state->receiveKey, true)) {
+		uprintf("AesCbc_init() failed\n");
+		goto fail;
+	}
+	HmacKey_init(&state->sendMac, state->sendMacKey);
+	HmacKey_init(&state->receiveMac, state->receiveMacKey);
 	state->initialized = true;
 	return false;
+	fail:
+	EncryptionState_release(state);
+	return true;
 }
 
 void EncryptionState_free(struct EncryptionState *state) {
 	if(!state->initialized)
 		return;
-	mbedtls_aes_free(&state->aes);
+	EncryptionState_release(state);
 	state->initialized = false;
 }
 
@@ -109,49 +121,29 @@ static bool PutSequenceNum(struct EncryptionState *state, uint32_t sequenceNum)
 	return false;
 }
 
-static bool FastHMAC(const uint8_t key[restrict static 64], const uint8_t *restrict data, size_t data_len, uint32_t sequence, uint8_t hash_out[restrict static 32]) {
-	uint8_t sequenceLE[4] = {sequence & 255, sequence >> 8 & 255, sequence >> 16 & 255, sequence >> 24 & 255};
-
-	bool err = false;
-	mbedtls_sha256_context ctx;
-	mbedtls_sha256_init(&ctx);
-
-	uint8_t pad[64], temp[32];
-	for(uint_fast8_t i = 0; i < sizeof(pad); ++i)
-		pad[i] = 0x36 ^ key[i];
-	err |= (mbedtls_sha256_starts(&ctx, false) != 0);
-	err |= (mbedtls_sha256_update(&ctx, pad, sizeof(pad)) != 0);
-	err |= (mbedtls_sha256_update(&ctx, data, data_len) != 0);
-	err |= (mbedtls_sha256_update(&ctx, sequenceLE, sizeof(sequenceLE)) != 0);
-	err |= (mbedtls_sha256_finish(&ctx, temp) != 0);
-
-	for(uint_fast8_t i = 0; i < sizeof(pad); ++i)
-		pad[i] ^= 0x6a;
-	err |= (mbedtls_sha256_starts(&ctx, false) != 0);
-	err |= (mbedtls_sha256_update(&ctx, pad, sizeof(pad)) != 0);
-	err |= (mbedtls_sha256_update(&ctx, temp, sizeof(temp)) != 0);
-	err |= (mbedtls_sha256_finish(&ctx, hash_out) != 0);
-	mbedtls_sha256_free(&ctx);
-
+static bool FastHMAC(const struct HmacKey *mac, [[maybe_unused]] const uint8_t key[restrict static 64], const uint8_t *restrict data, size_t data_len, uint32_t sequence, uint8_t hash_out[restrict static 32]) {
+	Hmac_run(&(struct HmacJob){
+		.key = mac,
+		.data = data,
+		.length = data_len,
+		.sequence = sequence,
+		.out = hash_out,
+	}, 1);
 	#ifdef DEBUG
-	err |= SafeValidateHMAC(key, data, data_len, sequence, hash_out);
+	return SafeValidateHMAC(key, data, data_len, sequence, hash_out);
+	#else
+	return false;
 	#endif
-	return err;
 }
 
-uint32_t EncryptionState_decrypt(struct EncryptionState *state, const uint8_t raw[static 1536], const uint8_t *raw_end, uint8_t out[restrict static 1536]) {
-	struct PacketEncryptionLayer header;
-	if(!pkt_read(&header, &raw, raw_end, PV_LEGACY_DEFAULT))
+// Decrypts and authenticates the body of an encrypted datagram. `out` may alias `body`, since CBC decryption only reads each block before it is overwritten.
+static uint32_t EncryptionState_open(struct EncryptionState *state, const struct PacketEncryptionLayer *header, const uint8_t *body, uint32_t length, uint8_t *out) {
+	if(!state->initialized || header->encrypted != 1 || length == 0 || length % 16 || InvalidSequenceNum(state, header->sequenceId))
 		return 0;
-	uint32_t length = (uint32_t)(raw_end - raw);
-	if(!header.encrypted) {
-		memcpy(out, raw, length);
-		return length;
-	}
-	if(!state->initialized || header.encrypted != 1 || length == 0 || length % 16 || InvalidSequenceNum(state, header.sequenceId))
+	uint8_t iv[16];
+	memcpy(iv, header->iv, sizeof(iv));
+	if(AesCbc_crypt(&state->decryptAes, length, iv, body, out))
 		return 0;
-	mbedtls_aes_setkey_dec(&state->aes, state->receiveKey, sizeof(state->receiveKey) * 8);
-	mbedtls_aes_crypt_cbc(&state->aes, MBEDTLS_AES_DECRYPT, length, header.iv, raw, out);
 	
 	uint8_t pad = out[length - 1];
 	if(pad + 11u > length)
@@ -159,41 +151,160 @@ uint32_t EncryptionState_decrypt(struct EncryptionState *state, const uint8_t ra
 	length -= pad + 11u;
 	uint8_t mac[10], expected[32];
 	memcpy(mac, &out[length], sizeof(mac));
-	if(FastHMAC(state->receiveMacKey, out, length, header.sequenceId, expected) || memcmp(mac, expected, sizeof(mac))) {
+	if(FastHMAC(&state->receiveMac, state->receiveMacKey, out, length, header->sequenceId, expected) || memcmp(mac, expected, sizeof(mac))) {
 		uprintf("Hash validation failed\n");
 		return 0;
 	}
-	if(PutSequenceNum(state, header.sequenceId))
+	if(PutSequenceNum(state, header->sequenceId))
 		return 0;
 	return length;
 }
 
-uint32_t EncryptionState_encrypt(struct EncryptionState *state, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]) {
-	if(state != NULL && state->initialized) {
-		struct PacketEncryptionLayer header = {
-			.encrypted = true,
-			.sequenceId = ++state->outboundSequence,
-		};
-		mbedtls_ctr_drbg_random(ctr_drbg, header.iv, sizeof(header.iv));
-		uint32_t header_len = (uint32_t)pkt_write(&header, (uint8_t*[]){out}, &out[1536], PV_LEGACY_DEFAULT);
-		uint8_t cap[16 + MBEDTLS_MD_MAX_SIZE], cap_len = buf_len & 15;
-		uint32_t cut_len = buf_len - cap_len;
-		memcpy(cap, &buf[cut_len], cap_len);
-		if(FastHMAC(state->sendMacKey, buf, buf_len, header.sequenceId, &cap[cap_len])) {
-			uprintf("FastHMAC() failed\n");
-			return 0;
+uint32_t EncryptionState_decrypt(struct EncryptionState *state, const uint8_t raw[static 1536], const uint8_t *raw_end, uint8_t out[restrict static 1536]) {
+	struct PacketEncryptionLayer header;
+	if(!pkt_read(&header, &raw, raw_end, PV_LEGACY_DEFAULT))
+		return 0;
+	uint32_t length = (uint32_t)(raw_end - raw);
+	if(!header.encrypted) {
+		memcpy(out, raw, length);
+		return length;
+	}
+	return EncryptionState_open(state, &header, raw, length, out);
+}
+
+uint32_t EncryptionState_decrypt_inplace(struct EncryptionState *state, uint8_t *raw, const uint8_t *raw_end, uint8_t **payload) {
+	struct PacketEncryptionLayer header;
+	const uint8_t *body = raw;
+	if(!pkt_read(&header, &body, raw_end, PV_LEGACY_DEFAULT))
+		return 0;
+	uint32_t length = (uint32_t)(raw_end - body);
+	*payload = &raw[body - raw];
+	if(!header.encrypted)
+		return length;
+	return EncryptionState_open(state, &header, *payload, length, *payload);
+}
+
+void IvSource_init(struct IvSource *ivs, mbedtls_ctr_drbg_context *ctr_drbg) {
+	ivs->ctr_drbg = ctr_drbg;
+	ivs->offset = sizeof(ivs->buffer);
+	ivs->refills = 0;
+	ivs->keyed = false;
+}
+
+void IvSource_free(struct IvSource *ivs) {
+	if(ivs->keyed)
+		AesCbc_free(&ivs->aes);
+	ivs->keyed = false;
+	ivs->offset = sizeof(ivs->buffer);
+}
+
+static bool IvSource_rekey(struct IvSource *ivs) {
+	uint8_t key[32];
+	if(mbedtls_ctr_drbg_random(ivs->ctr_drbg, key, sizeof(key)) || mbedtls_ctr_drbg_random(ivs->ctr_drbg, ivs->counter, sizeof(ivs->counter)))
+		return true;
+	IvSource_free(ivs);
+	ivs->keyed = !AesCbc_init(&ivs->aes, key, false);
+	memset(key, 0, sizeof(key));
+	return !ivs->keyed;
+}
+
+static bool IvSource_refill(struct IvSource *ivs) {
+	if(!ivs->keyed || ivs->refills >= IV_SOURCE_REKEY) {
+		if(IvSource_rekey(ivs))
+			return true;
+		ivs->refills = 0;
+	}
+	if(AesCbc_keystream(&ivs->aes, ivs->counter, sizeof(ivs->buffer), ivs->buffer))
+		return true;
+	++ivs->refills;
+	ivs->offset = 0;
+	return false;
+}
+
+static void IvSource_next(struct IvSource *ivs, uint8_t iv[static 16]) {
+	if(ivs->offset >= sizeof(ivs->buffer) && IvSource_refill(ivs)) {
+		uprintf("IvSource_refill() failed\n");
+		mbedtls_ctr_drbg_random(ivs->ctr_drbg, iv, 16); // slower, but just as unpredictable
+		return;
+	}
+	memcpy(iv, &ivs->buffer[ivs->offset], 16);
+	ivs->offset += 16;
+}
+
+// An encrypted datagram between its header being written and its body being encrypted, while its MAC is computed alongside others
+struct Seal {
+	struct PacketEncryptionLayer header;
+	uint32_t header_len;
+	uint8_t cap[16 + MBEDTLS_MD_MAX_SIZE], cap_len; // the trailing partial block, MAC and padding
+};
+
+static void EncryptionState_sealStart(struct EncryptionState *state, struct IvSource *ivs, const struct EncryptionJob *job, struct Seal *seal, struct HmacJob *mac) {
+	seal->header = (struct PacketEncryptionLayer){
+		.encrypted = true,
+		.sequenceId = ++state->outboundSequence,
+	};
+	IvSource_next(ivs, seal->header.iv);
+	seal->header_len = (uint32_t)pkt_write(&seal->header, (uint8_t*[]){job->out}, &job->out[1536], PV_LEGACY_DEFAULT);
+	seal->cap_len = job->buf_len & 15;
+	memcpy(seal->cap, &job->buf[job->buf_len - seal->cap_len], seal->cap_len);
+	*mac = (struct HmacJob){
+		.key = &state->sendMac,
+		.data = job->buf,
+		.length = job->buf_len,
+		.sequence = seal->header.sequenceId,
+		.out = &seal->cap[seal->cap_len],
+	};
+}
+
+static uint32_t EncryptionState_sealFinish(struct EncryptionState *state, const struct EncryptionJob *job, struct Seal *seal) {
+	#ifdef DEBUG
+	if(SafeValidateHMAC(state->sendMacKey, job->buf, job->buf_len, seal->header.sequenceId, &seal->cap[seal->cap_len]))
+		return 0;
+	#endif
+	uint32_t cut_len = job->buf_len - seal->cap_len;
+	seal->cap_len += 10;
+	uint8_t pad = 16 - ((job->buf_len + 10) & 15);
+	memset(&seal->cap[seal->cap_len], pad - 1, pad); seal->cap_len += pad;
+	if(AesCbc_crypt(&state->encryptAes, cut_len, seal->header.iv, job->buf, &job->out[seal->header_len]) || AesCbc_crypt(&state->encryptAes, seal->cap_len, seal->header.iv, seal->cap, &job->out[seal->header_len + cut_len])) {
+		uprintf("AesCbc_crypt() failed\n");
+		return 0;
+	}
+	return seal->header_len + cut_len + seal->cap_len;
+}
+
+void EncryptionState_encrypt_many(struct EncryptionJob *jobs, uint32_t count, struct IvSource *ivs) {
+	for(uint32_t base = 0; base < count; base += HMAC_LANES) {
+		uint32_t group = min32(count - base, HMAC_LANES), macs_len = 0;
+		struct Seal seals[HMAC_LANES];
+		struct HmacJob macs[HMAC_LANES];
+		for(uint32_t i = 0; i < group; ++i) {
+			struct EncryptionJob *job = &jobs[base + i];
+			if(job->state != NULL && job->state->initialized) {
+				EncryptionState_sealStart(job->state, ivs, job, &seals[i], &macs[macs_len++]);
+				continue;
+			}
+			uint32_t header_len = (uint32_t)pkt_write_c((uint8_t*[]){job->out}, &job->out[1536], PV_LEGACY_DEFAULT, PacketEncryptionLayer, {
+				.encrypted = false,
+			});
+			memcpy(&job->out[header_len], job->buf, job->buf_len);
+			job->out_len = header_len + job->buf_len;
+		}
+		Hmac_run(macs, macs_len);
+		for(uint32_t i = 0; i < group; ++i) {
+			struct EncryptionJob *job = &jobs[base + i];
+			if(job->state != NULL && job->state->initialized)
+				job->out_len = EncryptionState_sealFinish(job->state, job, &seals[i]);
 		}
-		cap_len += 10;
-		uint8_t pad = 16 - ((buf_len + 10) & 15);
-		memset(&cap[cap_len], pad - 1, pad); cap_len += pad;
-		mbedtls_aes_setkey_enc(&state->aes, state->sendKey, sizeof(state->sendKey) * 8);
-		mbedtls_aes_crypt_cbc(&state->aes, MBEDTLS_AES_ENCRYPT, cut_len, header.iv, buf, &out[header_len]);
-		mbedtls_aes_crypt_cbc(&state->aes, MBEDTLS_AES_ENCRYPT, cap_len, header.iv, cap, &out[header_len + cut_len]);
-		return header_len + cut_len + cap_len;
 	}
-	uint32_t header_len = (uint32_t)pkt_write_c((uint8_t*[]){out}, &out[1536], PV_LEGACY_DEFAULT, PacketEncryptionLayer, {
-		.encrypted = false,
-	});
-	memcpy(&out[header_len], buf, buf_len);
-	return header_len + buf_len;
+}
+
+uint32_t EncryptionState_encrypt(struct EncryptionState *state, struct IvSource *ivs, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]) {
+	struct EncryptionJob job = {
+		.state = state,
+		.buf = buf,
+		.buf_len = buf_len,
+		.out = out,
+	};
+	EncryptionState_encrypt_many(&job, 1, ivs);
+	return job.out_len;
 }
@@ -1,9 +1,12 @@
 #include "../common/packets.h"
+#include "aescbc.h"
+#include "hmac.h"
 #include <mbedtls/bignum.h>
 #include <mbedtls/ctr_drbg.h>
 
 struct EncryptionState {
-	mbedtls_aes_context aes;
+	struct AesCbc encryptAes, decryptAes; // key schedules for `sendKey` and `receiveKey`, expanded once by `EncryptionState_init()`
+	struct HmacKey sendMac, receiveMac; // HMAC-SHA256 of `sendMacKey` and `receiveMacKey` after the inner and outer pad blocks
 	uint8_t sendKey[32];
 	uint8_t receiveKey[32];
 	uint8_t sendMacKey[64];
@@ -14,8 +17,35 @@ struct EncryptionState {
 	bool initialized;
 };
 
+#define IV_SOURCE_SIZE 4096 // keystream generated per refill, enough for 256 IVs
+#define IV_SOURCE_REKEY 256 // refills between fresh keys drawn from the DRBG
+
+// Unpredictable CBC IVs served from an AES-CTR keystream, so the DRBG is only consulted once per `IV_SOURCE_REKEY * IV_SOURCE_SIZE / 16` packets
+struct IvSource {
+	mbedtls_ctr_drbg_context *ctr_drbg;
+	struct AesCbc aes;
+	uint8_t counter[16];
+	uint32_t offset, refills;
+	bool keyed;
+	uint8_t buffer[IV_SOURCE_SIZE];
+};
+
+// One outbound datagram for `EncryptionState_encrypt_many()`
+struct EncryptionJob {
+	struct EncryptionState *state; // NULL or uninitialized for an unencrypted datagram
+	const uint8_t *buf;
+	uint32_t buf_len;
+	uint8_t *out; // 1536 bytes
+	uint32_t out_len; // set to the datagram's size, or 0 on failure
+};
+
+void IvSource_init(struct IvSource *ivs, mbedtls_ctr_drbg_context *ctr_drbg); // keys itself on first use
+void IvSource_free(struct IvSource *ivs);
+
 struct Cookie32;
 bool EncryptionState_init(struct EncryptionState *state, const mbedtls_mpi *secret, const struct Cookie32 random[static 2], bool client);
 void EncryptionState_free(struct EncryptionState *state);
 uint32_t EncryptionState_decrypt(struct EncryptionState *state, const uint8_t raw[static 1536], const uint8_t *raw_end, uint8_t out[restrict static 1536]);
-uint32_t EncryptionState_encrypt(struct EncryptionState *state, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]);
+uint32_t EncryptionState_decrypt_inplace(struct EncryptionState *state, uint8_t *raw, const uint8_t *raw_end, uint8_t **payload); // leaves the payload in `raw`; `*payload` points at its start
+uint32_t EncryptionState_encrypt(struct EncryptionState *state, struct IvSource *ivs, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]);
+void EncryptionState_encrypt_many(struct EncryptionJob *jobs, uint32_t count, struct IvSource *ivs); // same as `EncryptionState_encrypt()` on each job in order, with the MACs computed `HMAC_LANES` at a time
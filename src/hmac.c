@@ -0,0 +1,257 @@
+#include "hmac.h"
+#include <stdatomic.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define HMAC_X86
+#define HMAC_VECTOR [[gnu::target("avx2")]]
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define HMAC_VECTOR // Advanced SIMD is part of the base architecture
+#endif
+
+typedef uint8_t HmacBackend;
+enum HmacBackend {
+	HmacBackend_Scalar,
+	HmacBackend_Vector, // `HMAC_LANES` messages per instruction
+	HmacBackend_ShaNi,
+};
+
+static const char *const HmacBackend_ToString[] = {"scalar", "multi-buffer", "SHA-NI"};
+
+typedef uint32_t HmacVec __attribute__((vector_size(4 * HMAC_LANES)));
+
+static const uint32_t Sha256_K[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2,
+};
+
+static const uint32_t Sha256_IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static inline uint32_t load_be32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return __builtin_bswap32(v);
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+	v = __builtin_bswap32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+#define ROTR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+// FIPS 180-4 compression of one block of host-order words, written once for both `uint32_t` and `HmacVec`
+#define SHA256_COMPRESS(name, type, ...) \
+	__VA_ARGS__ static void name(type state[restrict static 8], const type block[restrict static 16]) { \
+		type w[16], v[8]; \
+		memcpy(w, block, sizeof(w)); \
+		memcpy(v, state, sizeof(v)); \
+		_Pragma("GCC unroll 64") \
+		for(uint32_t t = 0; t < 64; ++t) { \
+			if(t >= 16) { \
+				type w15 = w[(t + 1) & 15], w2 = w[(t + 14) & 15]; \
+				w[t & 15] += (ROTR(w15, 7) ^ ROTR(w15, 18) ^ w15 >> 3) + w[(t + 9) & 15] + (ROTR(w2, 17) ^ ROTR(w2, 19) ^ w2 >> 10); \
+			} \
+			type t1 = v[7] + (ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + Sha256_K[t] + w[t & 15]; \
+			type t2 = (ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2])); \
+			for(uint32_t i = 7; i; --i) \
+				v[i] = v[i - 1]; \
+			v[4] += t1; \
+			v[0] = t1 + t2; \
+		} \
+		for(uint32_t i = 0; i < 8; ++i) \
+			state[i] += v[i]; \
+	}
+
+SHA256_COMPRESS(Sha256_compress_words, uint32_t)
+#ifdef HMAC_VECTOR
+SHA256_COMPRESS(Sha256_compress_lanes, HmacVec, HMAC_VECTOR)
+#endif
+
+static void Sha256_compress(uint32_t state[restrict static 8], const uint8_t block[restrict static 64]) {
+	uint32_t words[16];
+	for(uint32_t t = 0; t < 16; ++t)
+		words[t] = load_be32(&block[t * 4]);
+	Sha256_compress_words(state, words);
+}
+
+#ifdef HMAC_X86
+[[gnu::target("sha,sse4.1")]] static void ShaNi_compress(uint32_t state[restrict static 8], const uint8_t block[restrict static 64]) {
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0b, 0x0405060700010203);
+	__m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+	__m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+	__m128i abef = _mm_alignr_epi8(dcba, efgh, 8), cdgh = _mm_blend_epi16(efgh, dcba, 0xf0);
+	__m128i abef_start = abef, cdgh_start = cdgh, msg[4];
+	for(uint32_t q = 0; q < 16; ++q) {
+		if(q < 4)
+			msg[q] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&block[q * 16]), bswap);
+		else
+			msg[q & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(msg[q & 3], msg[(q + 1) & 3]), _mm_alignr_epi8(msg[(q + 3) & 3], msg[(q + 2) & 3], 4)), msg[(q + 3) & 3]);
+		__m128i wk = _mm_add_epi32(msg[q & 3], _mm_loadu_si128((const __m128i*)&Sha256_K[q * 4]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+	}
+	abef = _mm_add_epi32(abef, abef_start);
+	cdgh = _mm_add_epi32(cdgh, cdgh_start);
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1b), dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(feba, dchg, 0xf0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+void HmacKey_init(struct HmacKey *key, const uint8_t secret[static 64]) {
+	uint8_t pad[64];
+	for(uint32_t i = 0; i < sizeof(pad); ++i)
+		pad[i] = 0x36 ^ secret[i];
+	memcpy(key->inner, Sha256_IV, sizeof(key->inner));
+	Sha256_compress(key->inner, pad);
+	for(uint32_t i = 0; i < sizeof(pad); ++i)
+		pad[i] ^= 0x36 ^ 0x5c;
+	memcpy(key->outer, Sha256_IV, sizeof(key->outer));
+	Sha256_compress(key->outer, pad);
+}
+
+// The inner message after the pad block: whole blocks of `data` are read in place, the rest is assembled in `tail`
+struct HmacMessage {
+	const uint8_t *data;
+	uint32_t direct, blocks;
+	uint8_t tail[128];
+};
+
+static void HmacMessage_init(struct HmacMessage *msg, const struct HmacJob *job) {
+	size_t direct = job->length / 64, rest = job->length % 64, bits = (64 + job->length + 4) * 8;
+	msg->data = job->data;
+	msg->direct = (uint32_t)direct;
+	msg->blocks = (uint32_t)((job->length + 4 + 9 + 63) / 64);
+	size_t tail_len = (msg->blocks - direct) * 64;
+	memcpy(msg->tail, &job->data[direct * 64], rest);
+	for(uint32_t i = 0; i < 4; ++i)
+		msg->tail[rest + i] = (uint8_t)(job->sequence >> (i * 8));
+	msg->tail[rest + 4] = 0x80;
+	memset(&msg->tail[rest + 5], 0, tail_len - rest - 5 - 8);
+	for(uint32_t i = 0; i < 8; ++i)
+		msg->tail[tail_len - 1 - i] = (uint8_t)(bits >> (i * 8));
+}
+
+static const uint8_t *HmacMessage_block(const struct HmacMessage *msg, uint32_t index) {
+	return (index < msg->direct) ? &msg->data[index * 64] : &msg->tail[(index - msg->direct) * 64];
+}
+
+// The outer message is the 32-byte inner digest, padded to a single block
+static void Hmac_outerBlock(uint8_t block[static 64], const uint32_t digest[static 8]) {
+	for(uint32_t i = 0; i < 8; ++i)
+		store_be32(&block[i * 4], digest[i]);
+	memset(&block[32], 0, 32);
+	block[32] = 0x80;
+	block[62] = (64 + 32) * 8 >> 8;
+}
+
+static void Hmac_one(const struct HmacJob *job, void (*compress)(uint32_t[restrict static 8], const uint8_t[restrict static 64])) {
+	struct HmacMessage msg;
+	HmacMessage_init(&msg, job);
+	uint32_t state[8];
+	memcpy(state, job->key->inner, sizeof(state));
+	for(uint32_t i = 0; i < msg.blocks; ++i)
+		compress(state, HmacMessage_block(&msg, i));
+	uint8_t outer[64];
+	Hmac_outerBlock(outer, state);
+	memcpy(state, job->key->outer, sizeof(state));
+	compress(state, outer);
+	for(uint32_t i = 0; i < 8; ++i)
+		store_be32(&job->out[i * 4], state[i]);
+}
+
+#ifdef HMAC_VECTOR
+// Lanes past `count` repeat the first job and are discarded. Lanes whose message is shorter keep their state while the others finish.
+HMAC_VECTOR static void Hmac_lanes(const struct HmacJob *jobs, uint32_t count) {
+	struct HmacMessage msg[HMAC_LANES];
+	HmacVec state[8], blocks = {0};
+	uint32_t longest = 0;
+	for(uint32_t lane = 0; lane < HMAC_LANES; ++lane) {
+		const struct HmacJob *job = &jobs[(lane < count) ? lane : 0];
+		HmacMessage_init(&msg[lane], job);
+		blocks[lane] = msg[lane].blocks;
+		if(msg[lane].blocks > longest)
+			longest = msg[lane].blocks;
+		for(uint32_t i = 0; i < 8; ++i)
+			state[i][lane] = job->key->inner[i];
+	}
+	HmacVec words[16];
+	for(uint32_t index = 0; index < longest; ++index) {
+		for(uint32_t lane = 0; lane < HMAC_LANES; ++lane) {
+			const uint8_t *block = HmacMessage_block(&msg[lane], (index < msg[lane].blocks) ? index : msg[lane].blocks - 1);
+			for(uint32_t t = 0; t < 16; ++t)
+				words[t][lane] = load_be32(&block[t * 4]);
+		}
+		HmacVec next[8];
+		memcpy(next, state, sizeof(next));
+		Sha256_compress_lanes(next, words);
+		HmacVec active = (HmacVec)(blocks > index);
+		for(uint32_t i = 0; i < 8; ++i)
+			state[i] = (next[i] & active) | (state[i] & ~active);
+	}
+	for(uint32_t i = 0; i < 8; ++i)
+		words[i] = state[i];
+	words[8] = (HmacVec){0} + 0x80000000u;
+	for(uint32_t t = 9; t < 15; ++t)
+		words[t] = (HmacVec){0};
+	words[15] = (HmacVec){0} + (64 + 32) * 8;
+	for(uint32_t lane = 0; lane < HMAC_LANES; ++lane) {
+		const struct HmacJob *job = &jobs[(lane < count) ? lane : 0];
+		for(uint32_t i = 0; i < 8; ++i)
+			state[i][lane] = job->key->outer[i];
+	}
+	Sha256_compress_lanes(state, words);
+	for(uint32_t lane = 0; lane < count; ++lane)
+		for(uint32_t i = 0; i < 8; ++i)
+			store_be32(&jobs[lane].out[i * 4], state[i][lane]);
+}
+#endif
+
+static HmacBackend Hmac_detect(void) {
+	#ifdef HMAC_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+		return HmacBackend_ShaNi;
+	if(__builtin_cpu_supports("avx2"))
+		return HmacBackend_Vector;
+	#elif defined(HMAC_VECTOR)
+	return HmacBackend_Vector;
+	#endif
+	return HmacBackend_Scalar;
+}
+
+static HmacBackend Hmac_selected(void) {
+	static _Atomic int32_t selected = -1; // benign race: every thread detects the same answer
+	int32_t backend = atomic_load_explicit(&selected, memory_order_relaxed);
+	if(backend < 0) {
+		backend = Hmac_detect();
+		atomic_store_explicit(&selected, backend, memory_order_relaxed);
+	}
+	return (HmacBackend)backend;
+}
+
+const char *Hmac_backend(void) {
+	return HmacBackend_ToString[Hmac_selected()];
+}
+
+void Hmac_run(const struct HmacJob *jobs, uint32_t count) {
+	HmacBackend backend = Hmac_selected();
+	for(uint32_t i = 0; i < count;) {
+		#ifdef HMAC_VECTOR
+		if(backend == HmacBackend_Vector && count - i > 1) {
+			uint32_t lanes = (count - i < HMAC_LANES) ? count - i : HMAC_LANES;
+			Hmac_lanes(&jobs[i], lanes);
+			i += lanes;
+			continue;
+		}
+		#endif
+		#ifdef HMAC_X86
+		Hmac_one(&jobs[i++], (backend == HmacBackend_ShaNi) ? ShaNi_compress : Sha256_compress);
+		#else
+		Hmac_one(&jobs[i++], Sha256_compress);
+		#endif
+	}
+}
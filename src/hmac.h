@@ -0,0 +1,23 @@
+#pragma once
+#include "global.h"
+#include <stddef.h>
+
+#define HMAC_LANES 8 // messages hashed side by side by the multi-buffer backend
+
+// SHA-256 chaining values after an HMAC key's inner and outer pad blocks
+struct HmacKey {
+	uint32_t inner[8], outer[8];
+};
+
+// HMAC-SHA256 over `data` followed by `sequence` in little-endian, as the legacy encryption layer authenticates datagrams
+struct HmacJob {
+	const struct HmacKey *key;
+	const uint8_t *data;
+	size_t length;
+	uint32_t sequence;
+	uint8_t *out; // 32 bytes
+};
+
+void HmacKey_init(struct HmacKey *key, const uint8_t secret[static 64]);
+void Hmac_run(const struct HmacJob *jobs, uint32_t count); // hashes `HMAC_LANES` jobs at a time when the CPU allows it
+const char *Hmac_backend(void);
@@ -1,5 +1,6 @@
 #include "common.h"
 #include <stdlib.h>
+#include <stddef.h>
 #include <time.h>
 
 #define NET_MAX_SEQUENCE 0x8000
@@ -23,7 +24,8 @@ static inline bool ClearBit(uint8_t *data, uint32_t bit) {
 	return prev;
 }
 
-void instance_channels_init(struct Channels *channels) {
+static void Channels_service(void *userptr, struct TimerNode *node, uint32_t currentTime);
+void instance_channels_init(struct Channels *channels, struct TimerWheel *timers, struct NetSession *session) {
 	*channels = (struct Channels){
 		.ru.base = {
 			.ack.channelId = DeliveryMethod_ReliableUnordered,
@@ -35,10 +37,21 @@ void instance_channels_init(struct Channels *channels) {
 			.outboundSequence = 1, // ID 0 is skipped due to window size probing
 		},
 		.rs.ack.channelId = DeliveryMethod_ReliableSequenced,
+		.timers = timers,
+		.session = session,
+		.service = {
+			.callback = Channels_service,
+			.owner = channels,
+		},
 	};
 }
 
 void instance_channels_reset(struct Channels *channels) {
+	for(uint32_t i = 0; i < lengthof(channels->ru.base.resend); ++i)
+		TimerWheel_disarm(channels->timers, &channels->ru.base.resend[i].timer);
+	for(uint32_t i = 0; i < lengthof(channels->ro.base.resend); ++i)
+		TimerWheel_disarm(channels->timers, &channels->ro.base.resend[i].timer);
+	TimerWheel_disarm(channels->timers, &channels->service);
 	while(channels->ru.base.backlog) {
 		struct InstancePacketList *e = channels->ru.base.backlog;
 		channels->ru.base.backlog = e->next;
@@ -54,12 +67,28 @@ void instance_channels_reset(struct Channels *channels) {
 		channels->incomingFragmentsList = e->next;
 		free(e);
 	}
-	instance_channels_init(channels);
+	instance_channels_init(channels, channels->timers, channels->session);
+}
+
+void instance_channels_schedule(struct Channels *channels) {
+	if(!TimerNode_armed(&channels->service) || (int32_t)(channels->service.deadline - channels->timers->now) > 0)
+		TimerWheel_arm(channels->timers, &channels->service, channels->timers->now);
+}
+
+static void InstanceResendPacket_expire(void *userptr, struct TimerNode *node, uint32_t currentTime) {
+	struct InstanceResendPacket *packet = (struct InstanceResendPacket*)((uint8_t*)node - offsetof(struct InstanceResendPacket, timer));
+	struct Channels *channels = node->owner;
+	if(packet->pkt.len == 0)
+		return;
+	net_queue_merged((struct NetContext*)userptr, channels->session, packet->pkt.data, packet->pkt.len);
+	TimerWheel_arm(channels->timers, node, currentTime + NET_RESEND_DELAY);
 }
 
-static struct InstancePacket *resend_add(struct PacketContext version, struct ReliableChannel *channel, DeliveryMethod method, bool isFragmented) {
+static struct InstancePacket *resend_add(struct PacketContext version, struct Channels *channels, struct ReliableChannel *channel, DeliveryMethod method, bool isFragmented) {
 	struct InstanceResendPacket *resend = &channel->resend[channel->outboundSequence % version.windowSize];
-	resend->timeStamp = net_time() - NET_RESEND_DELAY;
+	resend->timer.callback = InstanceResendPacket_expire;
+	resend->timer.owner = channels;
+	TimerWheel_arm(channels->timers, &resend->timer, channels->timers->now); // first transmission goes out with the next flush
 	resend->pkt.len = (uint16_t)pkt_write_c((uint8_t*[]){resend->pkt.data}, endof(resend->pkt.data), version, NetPacketHeader, {
 		.property = PacketProperty_Channeled,
 		.isFragmented = isFragmented,
@@ -81,7 +110,7 @@ static void instance_send_backlog(struct PacketContext version, struct Channels
 	bool isFragmented = (fragmentHeader.fragmentsTotal != 0);
 	struct InstancePacket *packet = NULL;
 	if(RelativeSequenceNumber(channel->outboundSequence, channel->outboundWindowStart) < version.windowSize) {
-		packet = resend_add(version, channel, channelId, isFragmented);
+		packet = resend_add(version, channels, channel, channelId, isFragmented);
 	} else {
 		*channels->ro.base.backlogEnd = malloc(sizeof(struct InstancePacketList));
 		if(!*channels->ro.base.backlogEnd) {
@@ -126,8 +155,8 @@ void instance_send_channeled(struct NetSession *session, struct Channels *channe
 	instance_send_backlog(session->version, channels, buf, (uint16_t)len, channelId, fragmentHeader);
 }
 
-static void ReliableChannel_popBacklog(struct ReliableChannel *channel, struct PacketContext version, DeliveryMethod channelId) {
-	struct InstancePacket *resend = resend_add(version, channel, channelId, channel->backlog->isFragmented);
+static void ReliableChannel_popBacklog(struct Channels *channels, struct ReliableChannel *channel, struct PacketContext version, DeliveryMethod channelId) {
+	struct InstancePacket *resend = resend_add(version, channels, channel, channelId, channel->backlog->isFragmented);
 	resend->len += pkt_write_bytes(channel->backlog->pkt.data, (uint8_t*[]){&resend->data[resend->len]}, endof(resend->data), version, channel->backlog->pkt.len);
 
 	struct InstancePacketList *e = channel->backlog;
@@ -137,14 +166,14 @@ static void ReliableChannel_popBacklog(struct ReliableChannel *channel, struct P
 		channel->backlogEnd = &channel->backlog;
 }
 
-static void ReliableChannel_flushBacklog(struct ReliableChannel *channel, struct PacketContext version, DeliveryMethod channelId) {
+static void ReliableChannel_flushBacklog(struct Channels *channels, struct ReliableChannel *channel, struct PacketContext version, DeliveryMethod channelId) {
 	while(RelativeSequenceNumber(channel->outboundSequence, channel->outboundWindowStart) < version.windowSize && channel->backlog != NULL)
-		ReliableChannel_popBacklog(channel, version, channelId);
+		ReliableChannel_popBacklog(channels, channel, version, channelId);
 }
 
 void instance_channels_flushBacklog(struct Channels *channels, struct NetSession *session) {
-	ReliableChannel_flushBacklog(&channels->ru.base, session->version, DeliveryMethod_ReliableUnordered);
-	ReliableChannel_flushBacklog(&channels->ro.base, session->version, DeliveryMethod_ReliableOrdered);
+	ReliableChannel_flushBacklog(channels, &channels->ru.base, session->version, DeliveryMethod_ReliableUnordered);
+	ReliableChannel_flushBacklog(channels, &channels->ro.base, session->version, DeliveryMethod_ReliableOrdered);
 }
 
 void handle_Ack(struct NetSession *session, struct Channels *channels, const struct Ack *ack) {
@@ -162,13 +191,15 @@ void handle_Ack(struct NetSession *session, struct Channels *channels, const str
 		if(RelativeSequenceNumber(sequence, ack->sequence) >= session->version.windowSize)
 			break;
 		uint16_t pendingIdx = sequence % session->version.windowSize;
-		if(GetBit(ack->data, pendingIdx))
+		if(GetBit(ack->data, pendingIdx)) {
 			channel->resend[pendingIdx].pkt.len = 0;
+			TimerWheel_disarm(channels->timers, &channel->resend[pendingIdx].timer);
+		}
 		if(channel->resend[pendingIdx].pkt.len || sequence != channel->outboundWindowStart)
 			continue;
 		channel->outboundWindowStart = (channel->outboundWindowStart + 1) % NET_MAX_SEQUENCE;
 		if(channel->backlog != NULL)
-			ReliableChannel_popBacklog(channel, session->version, ack->channelId);
+			ReliableChannel_popBacklog(channels, channel, session->version, ack->channelId);
 	}
 }
 
@@ -243,6 +274,7 @@ void handle_Channeled(ChanneledHandler handler, void *userptr, struct NetContext
 				--delta;
 			}
 			channel->sendAck = true;
+			instance_channels_schedule(channels);
 			uint16_t ackIdx = channeled.sequence % session->version.windowSize;
 			if(SetBit(channel->ack.data, ackIdx))
 				break;
@@ -299,15 +331,8 @@ void handle_Channeled(ChanneledHandler handler, void *userptr, struct NetContext
 	return;
 }
 
-static uint64_t get_time() {
-	struct timespec now;
-	if(clock_gettime(CLOCK_MONOTONIC, &now))
-		return 0;
-	return (uint64_t)now.tv_sec * 10000000LLU + (uint64_t)now.tv_nsec / 100LLU;
-}
-
 void handle_Ping(struct NetContext *net, struct NetSession *session, struct PingPong *pingpong, struct Ping ping) {
-	uint64_t time = get_time();
+	uint64_t time = NetClock_ticks(&net->clock);
 	if(RelativeSequenceNumber(ping.sequence, pingpong->pong.sequence) > 0) {
 		pingpong->pong.sequence = ping.sequence;
 		pingpong->pong.time = time;
@@ -331,11 +356,11 @@ void handle_Ping(struct NetContext *net, struct NetSession *session, struct Ping
 	}
 }
 
-float handle_Pong(struct NetContext*, struct NetSession*, struct PingPong *pingpong, struct Pong pong) {
+float handle_Pong(struct NetContext *net, struct NetSession*, struct PingPong *pingpong, struct Pong pong) {
 	if(pong.sequence != pingpong->ping.sequence)
 		return -1;
 	pingpong->waiting = false;
-	return (float)((double)(get_time() - pingpong->lastPing) / 10000000.);
+	return (float)((double)(NetClock_ticks(&net->clock) - pingpong->lastPing) / 10000000.);
 }
 
 void handle_MtuCheck(struct NetContext *net, struct NetSession *session, const struct MtuCheck *req) {
@@ -347,11 +372,9 @@ void handle_MtuCheck(struct NetContext *net, struct NetSession *session, const s
 	net_send_internal(net, session, resp, (uint32_t)(resp_end - resp), true);
 }
 
-static void InstanceResendPacket_trySend(struct InstanceResendPacket *packet, struct NetContext *net, struct NetSession *session, uint32_t currentTime) {
-	if(packet->pkt.len == 0 || currentTime - packet->timeStamp < NET_RESEND_DELAY)
-		return;
-	net_queue_merged(net, session, packet->pkt.data, packet->pkt.len);
-	packet->timeStamp = currentTime - (currentTime - packet->timeStamp) % NET_RESEND_DELAY;
+void handle_MtuOk(struct NetSession *session, const struct MtuOk *req) {
+	if(req->base.newMtu0 == req->base.newMtu1)
+		net_confirm_mtu(session, req->base.newMtu0);
 }
 
 static void Ack_flush(struct Ack *ack, struct NetContext *net, struct NetSession *session) {
@@ -363,7 +386,10 @@ static void Ack_flush(struct Ack *ack, struct NetContext *net, struct NetSession
 	net_queue_merged(net, session, resp, (uint16_t)(resp_end - resp));
 }
 
-uint32_t instance_channels_tick(struct Channels *channels, struct NetContext *net, struct NetSession *session, uint32_t currentTime) {
+static void Channels_service(void *userptr, struct TimerNode *node, uint32_t currentTime) {
+	struct NetContext *net = userptr;
+	struct Channels *channels = node->owner;
+	struct NetSession *session = channels->session;
 	if(!session->version.windowSize) {
 		uint8_t resp[65536];
 		uint16_t length = (uint16_t)pkt_write_c((uint8_t*[]){resp}, endof(resp), session->version, NetPacketHeader, {
@@ -371,16 +397,11 @@ uint32_t instance_channels_tick(struct Channels *channels, struct NetContext *ne
 			.channeled.channelId = DeliveryMethod_ReliableOrdered,
 		});
 		net_queue_merged(net, session, resp, length);
-		return 15;
+		TimerWheel_arm(channels->timers, node, currentTime + WINDOW_PROBE_INTERVAL_MS);
+	} else {
+		for(; channels->ru.base.sendAck; channels->ru.base.sendAck = false)
+			Ack_flush(&channels->ru.base.ack, net, session);
+		for(; channels->ro.base.sendAck; channels->ro.base.sendAck = false)
+			Ack_flush(&channels->ro.base.ack, net, session);
 	}
-	for(; channels->ru.base.sendAck; channels->ru.base.sendAck = false)
-		Ack_flush(&channels->ru.base.ack, net, session);
-	for(; channels->ro.base.sendAck; channels->ro.base.sendAck = false)
-		Ack_flush(&channels->ro.base.ack, net, session);
-	for(uint32_t i = 0; i < lengthof(channels->ru.base.resend); ++i)
-		InstanceResendPacket_trySend(&channels->ru.base.resend[i], net, session, currentTime);
-	for(uint32_t i = 0; i < lengthof(channels->ro.base.resend); ++i)
-		InstanceResendPacket_trySend(&channels->ro.base.resend[i], net, session, currentTime);
-	InstanceResendPacket_trySend(&channels->rs.resend, net, session, currentTime);
-	return 15; // TODO: proper resend timing
 }
@@ -1,5 +1,6 @@
 #include "../global.h"
 #include "../net.h"
+#include "timer.h"
 #ifndef PACKETS_H
 #include "../packets.h"
 #endif
@@ -9,6 +10,8 @@
 #define KICK_TIMEOUT_MS 3000
 
 #define NET_MAX_WINDOW_SIZE 256
+#define WINDOW_PROBE_INTERVAL_MS 15
+#define MTU_PROBE_INTERVAL_MS 1000
 
 #define bitsize(e) (sizeof(e) * 8)
 #define indexof(a, e) ((uintptr_t)((e) - (a)))
@@ -97,7 +100,7 @@ struct InstancePacket {
 	uint8_t data[NET_MAX_PKT_SIZE];
 };
 struct InstanceResendPacket {
-	uint32_t timeStamp;
+	struct TimerNode timer; // armed while `pkt` is unacknowledged
 	struct InstancePacket pkt;
 };
 struct ReliableChannel {
@@ -146,6 +149,9 @@ struct Channels {
 	struct ReliableOrderedChannel ro;
 	struct SequencedChannel rs;
 	struct IncomingFragments *incomingFragmentsList;
+	struct TimerWheel *timers;
+	struct NetSession *session;
+	struct TimerNode service; // flushes acks, and probes the window size until it's known
 };
 struct PingPong {
 	uint64_t lastPing;
@@ -156,13 +162,15 @@ struct PingPong {
 
 typedef void (*ChanneledHandler)(void *userptr, const uint8_t **data, const uint8_t *end, DeliveryMethod channelId);
 
-void instance_channels_init(struct Channels *channels);
+// Timer callbacks registered by the channels expect `TimerWheel_run()` to be passed the owning `NetContext`
+void instance_channels_init(struct Channels *channels, struct TimerWheel *timers, struct NetSession *session);
 void instance_channels_reset(struct Channels *channels);
+void instance_channels_schedule(struct Channels *channels); // queue pending acks on the next timer pass
 void instance_channels_flushBacklog(struct Channels *channels, struct NetSession *session);
-uint32_t instance_channels_tick(struct Channels *channels, struct NetContext *net, struct NetSession *session, uint32_t currentTime);
 void instance_send_channeled(struct NetSession *session, struct Channels *channels, const uint8_t *buf, uint32_t len, DeliveryMethod method);
 void handle_Ack(struct NetSession *session, struct Channels *channels, const struct Ack *ack);
 void handle_Channeled(ChanneledHandler handler, void *userptr, struct NetContext *net, struct NetSession *session, struct Channels *channels, const struct NetPacketHeader *header, const uint8_t **data, const uint8_t *end);
 void handle_Ping(struct NetContext *net, struct NetSession *session, struct PingPong *pingpong, struct Ping ping);
 float handle_Pong(struct NetContext *net, struct NetSession *session, struct PingPong *pingpong, struct Pong pong);
 void handle_MtuCheck(struct NetContext *net, struct NetSession *session, const struct MtuCheck *req);
+void handle_MtuOk(struct NetSession *session, const struct MtuOk *req);
@@ -4,6 +4,7 @@
 #include <mbedtls/error.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 #include <inttypes.h>
@@ -51,6 +52,11 @@ struct InstanceSession {
 	} identity;
 	#endif
 	bool sentIdentity;
+	bool indexed; // `addrKey` is present in the context's `sessionIndex`
+	bool pending; // allocated by the master, but no packet has decrypted yet; listed in the context's `pending`
+	struct NetAddrKey addrKey; // canonical form of `net.addr`, computed once when the session resolves
+	struct TimerNode keepAlive; // idle timeout; `owner` is the session's `struct Room**`
+	struct TimerNode mtuProbe; // path MTU discovery, armed once the session has connected
 	uint32_t joinOrder;
 
 	ServerState state;
@@ -64,6 +70,7 @@ struct Room {
 	playerid_t serverOwner;
 	struct GameplayServerConfiguration configuration;
 	struct timespec syncBase;
+	struct TimerNode countdown; // armed at `global.timeout` while in a `ServerState_Timeout` state; `owner` is the room's `struct Room**`
 	float shortCountdown, longCountdown;
 	bool skipResults, perPlayerDifficulty, perPlayerModifiers;
 	uint32_t joinCount;
@@ -110,18 +117,55 @@ struct Room {
 	struct InstanceSession players[];
 };
 
+#define SESSION_INDEX_EMPTY UINT16_MAX
+#define SESSION_INDEX_TOMBSTONE (UINT16_MAX - 1)
+
+// Open-addressing map of resolved addresses to their sessions. `ipIndex` reuses it as a multimap, keyed by IP alone.
+struct SessionIndex {
+	uint32_t capacity, used, live; // `used` includes tombstones
+	struct SessionIndexEntry {
+		struct NetAddrKey key;
+		uint16_t room; // index into `*rooms`, or one of `SESSION_INDEX_EMPTY`/`SESSION_INDEX_TOMBSTONE`
+		playerid_t id;
+	} *entries;
+};
+
+#define PENDING_MISS_TTL_MS 1000
+
+// Sessions waiting for their first packet, in allocation order
+struct PendingList {
+	uint32_t count, capacity;
+	uint32_t generation; // bumped on every new entry, invalidating all of `misses`
+	struct PendingSession {
+		uint8_t ip[16]; // source IP the master saw for this client, in `NetAddrKey` form
+		uint16_t room;
+		playerid_t id;
+	} *entries;
+	struct PendingMiss { // addresses which recently failed to decrypt against every entry
+		struct NetAddrKey key;
+		uint32_t generation, time;
+	} misses[256];
+};
+
 struct InstanceContext {
 	struct NetContext net;
 	union WireLink *master;
 	struct Counter64 roomMask;
 	struct Room *rooms[64][4];
+	struct SessionIndex sessionIndex;
+	struct SessionIndex ipIndex; // the same sessions keyed by `addrKey` with the port cleared, for finding the session of a client whose NAT picked a new port
+	struct PendingList pending;
+	struct TimerWheel timers;
+	struct {
+		struct TimerNode window; // armed while `current` is counting
+		struct InstanceResolveStats current;
+		atomic_uint trials, resolved, cached, rejected, migrated; // the last full second, read from other threads by `instance_get_resolveStats()`
+	} resolveStats;
 };
 static struct InstanceContext *contexts = NULL;
 
-static float room_get_syncTime(struct Room *room) {
-	struct timespec now;
-	if(clock_gettime(CLOCK_MONOTONIC, &now))
-		return 0;
+static float room_get_syncTime(const struct InstanceContext *ctx, const struct Room *room) {
+	const struct timespec now = ctx->net.clock.mono;
 	return (float)((double)(now.tv_sec - room->syncBase.tv_sec) + 1e-9 * (double)(now.tv_nsec - room->syncBase.tv_nsec));
 }
 
@@ -307,7 +351,7 @@ static float room_get_countdownEnd(const struct Room *room, float defaultTime) {
 static bool room_try_finish(struct InstanceContext *ctx, struct Room *room);
 static void session_set_state(struct InstanceContext *ctx, struct Room *room, struct InstanceSession *session, ServerState state) {
 	struct RemoteProcedureCall base = {
-		.syncTime = room_get_syncTime(room),
+		.syncTime = room_get_syncTime(ctx, room),
 	};
 	uint8_t resp[65536], *resp_end = resp;
 	pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
@@ -568,6 +612,15 @@ static const char *ServerState_toString(ServerState state) {
 	return "???";
 }
 
+static void room_arm_countdown(struct InstanceContext *ctx, struct Room *room) {
+	if(!(room->state & ServerState_Timeout)) {
+		TimerWheel_disarm(&ctx->timers, &room->countdown);
+		return;
+	}
+	float delta = room->global.timeout - room_get_syncTime(ctx, room);
+	TimerWheel_arm(&ctx->timers, &room->countdown, ctx->net.clock.ms + ((delta > 0) ? (uint32_t)(delta * 1000) + 1 : 0));
+}
+
 static void room_set_state(struct InstanceContext *ctx, struct Room *room, ServerState state) {
 	uprintf("state %s -> %s\n", ServerState_toString(room->state), ServerState_toString(state));
 	if(STATE_EDGE(room->state, state, ServerState_Lobby)) {
@@ -675,13 +728,13 @@ static void room_set_state(struct InstanceContext *ctx, struct Room *room, Serve
 			} else if((room->state & ServerState_Selected) >= ServerState_Lobby_LongCountdown) {
 				return;
 			}
-			room->global.timeout = room_get_syncTime(room) + room->longCountdown;
+			room->global.timeout = room_get_syncTime(ctx, room) + room->longCountdown;
 			break;
 		}
 		case ServerState_Lobby_ShortCountdown: {
 			if((room->state & ServerState_Selected) >= ServerState_Lobby_ShortCountdown)
 				return;
-			room->global.timeout = room_get_syncTime(room) + room->shortCountdown;
+			room->global.timeout = room_get_syncTime(ctx, room) + room->shortCountdown;
 			break;
 		}
 		case ServerState_Lobby_Downloading: {
@@ -693,7 +746,7 @@ static void room_set_state(struct InstanceContext *ctx, struct Room *room, Serve
 		}
 		case ServerState_Game_LoadingScene: {
 			room->game.loadingScene.isLoaded = COUNTERP_CLEAR;
-			room->global.timeout = room_get_syncTime(room) + LOAD_TIMEOUT;
+			room->global.timeout = room_get_syncTime(ctx, room) + LOAD_TIMEOUT;
 			break;
 		}
 		case ServerState_Game_LoadingSong: {
@@ -704,7 +757,7 @@ static void room_set_state(struct InstanceContext *ctx, struct Room *room, Serve
 			}
 			mbedtls_ctr_drbg_random(&ctx->net.ctr_drbg, (uint8_t*)room->global.sessionId, sizeof(room->global.sessionId));
 			room->game.loadingSong.isLoaded = COUNTERP_CLEAR;
-			room->global.timeout = room_get_syncTime(room) + LOAD_TIMEOUT;
+			room->global.timeout = room_get_syncTime(ctx, room) + LOAD_TIMEOUT;
 			break;
 		}
 		case ServerState_Game_Gameplay: {
@@ -713,12 +766,13 @@ static void room_set_state(struct InstanceContext *ctx, struct Room *room, Serve
 				if(room_try_finish(ctx, room))
 					return;
 			}
-			room->game.startTime = room_get_syncTime(room) + .25f;
+			room->game.startTime = room_get_syncTime(ctx, room) + .25f;
 			break;
 		}
-		case ServerState_Game_Results: room->global.timeout = room_get_syncTime(room) + (room->game.showResults ? 20 : 1); break;
+		case ServerState_Game_Results: room->global.timeout = room_get_syncTime(ctx, room) + (room->game.showResults ? 20 : 1); break;
 	}
 	room->state = state;
+	room_arm_countdown(ctx, room);
 	FOR_SOME_PLAYERS(id, room->connected,)
 		session_set_state(ctx, room, &room->players[id], state);
 }
@@ -759,7 +813,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 			struct MenuRpc r_missing = {
 				.type = MenuRpcType_SetPlayersMissingEntitlementsToLevel,
 				.setPlayersMissingEntitlementsToLevel = {
-					.base.syncTime = room_get_syncTime(room),
+					.base.syncTime = room_get_syncTime(ctx, room),
 					.flags = {true, false, false, false},
 					.count = 0,
 				},
@@ -787,7 +841,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 		NOT_IMPLEMENTED(MenuRpcType_SelectLevelPack);
 		case MenuRpcType_SetSelectedBeatmap: uprintf("BAD TYPE: MenuRpcType_SetSelectedBeatmap\n"); break;
 		case MenuRpcType_GetSelectedBeatmap: {
-			struct RemoteProcedureCall base = {room_get_syncTime(room)};
+			struct RemoteProcedureCall base = {room_get_syncTime(ctx, room)};
 			uint8_t resp[65536], *resp_end = resp;
 			pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
 			SERIALIZE_MENURPC(&resp_end, endof(resp), session->net.version, {
@@ -810,7 +864,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 			if(!((room->state & ServerState_Lobby) && session_get_permissions(room, session, false).recommendBeatmaps))
 				break;
 			if(!BeatmapIdentifier_eq(&session->recommendedBeatmap, &beatmap.identifier, room->perPlayerDifficulty))
-				session->recommendTime = room_get_syncTime(room);
+				session->recommendTime = room_get_syncTime(ctx, room);
 			session->recommendedBeatmap = beatmap.identifier;
 			room_set_state(ctx, room, ServerState_Lobby_Entitlement);
 			break;
@@ -818,7 +872,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 		case MenuRpcType_GetRecommendedBeatmap: break;
 		case MenuRpcType_SetSelectedGameplayModifiers: uprintf("BAD TYPE: MenuRpcType_SetSelectedGameplayModifiers\n"); break;
 		case MenuRpcType_GetSelectedGameplayModifiers: {
-			struct RemoteProcedureCall base = {room_get_syncTime(room)};
+			struct RemoteProcedureCall base = {room_get_syncTime(ctx, room)};
 			uint8_t resp[65536], *resp_end = resp;
 			pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
 			SERIALIZE_MENURPC(&resp_end, endof(resp), session->net.version, {
@@ -844,7 +898,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 			if(indexof(room->players, session) != room->lobby.requester)
 				break;
 			room->global.selectedModifiers = modifiers.gameplayModifiers;
-			struct RemoteProcedureCall base = {room_get_syncTime(room)};
+			struct RemoteProcedureCall base = {room_get_syncTime(ctx, room)};
 			FOR_SOME_PLAYERS(id, room->connected,) {
 				uint8_t resp[65536], *resp_end = resp;
 				pkt_write_c(&resp_end, endof(resp), room->players[id].net.version, RoutingHeader, {0, 127, false});
@@ -873,7 +927,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 					room_set_state(ctx, room, ServerState_Lobby_Entitlement);
 				break;
 			}
-			struct RemoteProcedureCall base = {room_get_syncTime(room)};
+			struct RemoteProcedureCall base = {room_get_syncTime(ctx, room)};
 			uint8_t resp[65536], *resp_end = resp;
 			pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
 			SERIALIZE_MENURPC(&resp_end, endof(resp), session->net.version, {
@@ -897,7 +951,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 			SERIALIZE_MENURPC(&resp_end, endof(resp), session->net.version, {
 				.type = MenuRpcType_SetMultiplayerGameState,
 				.setMultiplayerGameState = {
-					.base.syncTime = room_get_syncTime(room),
+					.base.syncTime = room_get_syncTime(ctx, room),
 					.flags = {true, false, false, false},
 					.lobbyState = (room->state & ServerState_Lobby) ? MultiplayerGameState_Lobby : MultiplayerGameState_Game,
 				},
@@ -926,7 +980,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 		case MenuRpcType_GetCountdownEndTime: {
 			if(!(room->state & ServerState_Lobby))
 				break;
-			struct RemoteProcedureCall base = {room_get_syncTime(room)};
+			struct RemoteProcedureCall base = {room_get_syncTime(ctx, room)};
 			uint8_t resp[65536], *resp_end = resp;
 			pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
 			SERIALIZE_MENURPC(&resp_end, endof(resp), session->net.version, {
@@ -971,7 +1025,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 				if(pkt_serialize(&r_kick, &resp_end, endof(resp), room->players[id].net.version))
 					instance_send_channeled(&room->players[id].net, &room->players[id].channels, resp, (uint32_t)(resp_end - resp), DeliveryMethod_ReliableOrdered);
 				room->players[id].net.alive = false; // timeout if client refuses to leave
-				uint32_t time = net_time();
+				uint32_t time = ctx->net.clock.ms;
 				if(time - room->players[id].net.lastKeepAlive < IDLE_TIMEOUT_MS - KICK_TIMEOUT_MS)
 					room->players[id].net.lastKeepAlive = time + KICK_TIMEOUT_MS - IDLE_TIMEOUT_MS;
 			}
@@ -982,7 +1036,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 			struct MenuRpc r_permission = {
 				.type = MenuRpcType_SetPermissionConfiguration,
 				.setPermissionConfiguration = {
-					.base.syncTime = room_get_syncTime(room),
+					.base.syncTime = room_get_syncTime(ctx, room),
 					.flags = {true, false, false, false},
 					.playersPermissionConfiguration = room_get_permissions(room, room->connected, session),
 				},
@@ -997,7 +1051,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 			uprintf("GET BUTTON GET BUTTON GET BUTTON GET BUTTON GET BUTTON\n");
 			if(!(room->state & ServerState_Lobby))
 				break;
-			struct RemoteProcedureCall base = {room_get_syncTime(room)};
+			struct RemoteProcedureCall base = {room_get_syncTime(ctx, room)};
 			uint8_t resp[65536], *resp_end = resp;
 			pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
 			SERIALIZE_MENURPC(&resp_end, endof(resp), session->net.version, {
@@ -1189,7 +1243,7 @@ static void handle_PlayerIdentity(struct InstanceContext *ctx, struct Room *room
 	}
 
 	struct RemoteProcedureCall base = {
-		.syncTime = room_get_syncTime(room),
+		.syncTime = room_get_syncTime(ctx, room),
 	};
 	FOR_SOME_PLAYERS(id, room->connected,) {
 		uint8_t resp[65536], *resp_end = resp;
@@ -1310,7 +1364,7 @@ static void process_message(struct InstanceContext *ctx, struct Room *room, stru
 				};
 				struct InternalMessage r_sync = {
 					.type = InternalMessageType_SyncTime,
-					.syncTime.syncTime = room_get_syncTime(room),
+					.syncTime.syncTime = room_get_syncTime(ctx, room),
 				};
 				uint8_t resp[65536], *resp_end = resp;
 				pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
@@ -1408,12 +1462,13 @@ static void handle_ConnectRequest(struct InstanceContext *ctx, struct Room *room
 	pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 127, false});
 	struct InternalMessage r_sync = {
 		.type = InternalMessageType_SyncTime,
-		.syncTime.syncTime = room_get_syncTime(room),
+		.syncTime.syncTime = room_get_syncTime(ctx, room),
 	};
 	if(pkt_serialize(&r_sync, &resp_end, endof(resp), session->net.version))
 		instance_send_channeled(&session->net, &session->channels, resp, (uint32_t)(resp_end - resp), DeliveryMethod_ReliableOrdered);
 
 	uprintf("connect[%zu]: %.*s (%.*s)\n", indexof(room->players, session), session->userName.length, session->userName.data, session->userId.length, session->userId.data);
+	TimerWheel_arm(&ctx->timers, &session->mtuProbe, ctx->net.clock.ms);
 
 	resp_end = resp;
 	pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
@@ -1492,8 +1547,201 @@ static inline struct Room **instance_get_room(struct InstanceContext *ctx, uint3
 	return &ctx->rooms[0][roomID];
 }
 
+static struct SessionIndexEntry *SessionIndex_find(struct SessionIndex *index, const struct NetAddrKey *key, bool insert) {
+	if(!index->capacity)
+		return NULL;
+	struct SessionIndexEntry *tombstone = NULL;
+	for(uint32_t mask = index->capacity - 1, i = NetAddrKey_hash(key) & mask;; i = (i + 1) & mask) {
+		struct SessionIndexEntry *entry = &index->entries[i];
+		if(entry->room == SESSION_INDEX_EMPTY)
+			return insert ? (tombstone ? tombstone : entry) : NULL;
+		if(entry->room == SESSION_INDEX_TOMBSTONE) {
+			if(!tombstone)
+				tombstone = entry;
+		} else if(memcmp(&entry->key, key, sizeof(*key)) == 0) {
+			return entry;
+		}
+	}
+}
+
+// First free slot along the probe sequence of `key`, regardless of any entries already present for it
+static struct SessionIndexEntry *SessionIndex_vacancy(struct SessionIndex *index, const struct NetAddrKey *key) {
+	for(uint32_t mask = index->capacity - 1, i = NetAddrKey_hash(key) & mask;; i = (i + 1) & mask)
+		if(index->entries[i].room >= SESSION_INDEX_TOMBSTONE)
+			return &index->entries[i];
+}
+
+// Iterates over every entry for `key`, starting with `*cursor = 0`
+static struct SessionIndexEntry *SessionIndex_next(struct SessionIndex *index, const struct NetAddrKey *key, uint32_t hash, uint32_t *cursor) {
+	for(uint32_t mask = index->capacity - 1; *cursor < index->capacity;) {
+		struct SessionIndexEntry *entry = &index->entries[(hash + (*cursor)++) & mask];
+		if(entry->room == SESSION_INDEX_EMPTY)
+			break;
+		if(entry->room != SESSION_INDEX_TOMBSTONE && memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static bool SessionIndex_rehash(struct SessionIndex *index, uint32_t capacity) {
+	struct SessionIndexEntry *old = index->entries, *old_end = &old[index->capacity];
+	index->entries = malloc(capacity * sizeof(*index->entries));
+	if(!index->entries) {
+		index->entries = old;
+		return true;
+	}
+	for(uint32_t i = 0; i < capacity; ++i)
+		index->entries[i].room = SESSION_INDEX_EMPTY;
+	index->capacity = capacity;
+	index->used = index->live;
+	for(struct SessionIndexEntry *it = old; it < old_end; ++it)
+		if(it->room < SESSION_INDEX_TOMBSTONE)
+			*SessionIndex_vacancy(index, &it->key) = *it; // keys are unique in `sessionIndex`, and duplicates are intended in `ipIndex`
+	free(old);
+	return false;
+}
+
+static bool SessionIndex_reserve(struct SessionIndex *index) {
+	if((index->used + 1) * 2 <= index->capacity)
+		return false;
+	uint32_t capacity = 64;
+	while(capacity < (index->live + 1) * 4)
+		capacity *= 2;
+	return SessionIndex_rehash(index, capacity);
+}
+
+static void SessionIndex_put(struct SessionIndex *index, struct SessionIndexEntry *entry, struct SessionIndexEntry value) {
+	if(entry->room == SESSION_INDEX_EMPTY)
+		++index->used;
+	if(entry->room >= SESSION_INDEX_TOMBSTONE)
+		++index->live;
+	*entry = value;
+}
+
+static void SessionIndex_erase(struct SessionIndex *index, struct SessionIndexEntry *entry) {
+	entry->room = SESSION_INDEX_TOMBSTONE;
+	--index->live;
+}
+
+static inline struct NetAddrKey NetAddrKey_ip(struct NetAddrKey key) {
+	key.port = 0;
+	return key;
+}
+
+static void session_index_add(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session) {
+	session->addrKey = SS_key(NetSession_get_addr(&session->net));
+	if(SessionIndex_reserve(&ctx->sessionIndex) || SessionIndex_reserve(&ctx->ipIndex)) {
+		uprintf("alloc error\n");
+		return;
+	}
+	struct SessionIndexEntry value = {
+		.key = session->addrKey,
+		.room = (uint16_t)indexof(*ctx->rooms, room),
+		.id = (playerid_t)indexof((*room)->players, session),
+	};
+	SessionIndex_put(&ctx->sessionIndex, SessionIndex_find(&ctx->sessionIndex, &session->addrKey, true), value);
+	value.key = NetAddrKey_ip(session->addrKey);
+	SessionIndex_put(&ctx->ipIndex, SessionIndex_vacancy(&ctx->ipIndex, &value.key), value);
+	session->indexed = true;
+	net_expect_ip(&ctx->net, &session->addrKey, true); // a new port on the same IP may still reach another shard
+}
+
+static void session_index_remove(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session) {
+	if(!session->indexed)
+		return;
+	session->indexed = false;
+	net_expect_ip(&ctx->net, &session->addrKey, false);
+	struct SessionIndexEntry *entry = SessionIndex_find(&ctx->sessionIndex, &session->addrKey, false);
+	if(entry)
+		SessionIndex_erase(&ctx->sessionIndex, entry);
+	const struct NetAddrKey ip = NetAddrKey_ip(session->addrKey);
+	uint16_t roomIndex = (uint16_t)indexof(*ctx->rooms, room);
+	playerid_t id = (playerid_t)indexof((*room)->players, session);
+	for(uint32_t hash = NetAddrKey_hash(&ip), cursor = 0; (entry = SessionIndex_next(&ctx->ipIndex, &ip, hash, &cursor));) {
+		if(entry->room == roomIndex && entry->id == id) {
+			SessionIndex_erase(&ctx->ipIndex, entry);
+			return;
+		}
+	}
+}
+
+static bool pending_reserve(struct InstanceContext *ctx) {
+	struct PendingList *pending = &ctx->pending;
+	if(pending->count < pending->capacity)
+		return false;
+	uint32_t capacity = pending->capacity ? pending->capacity * 2 : 16;
+	struct PendingSession *entries = realloc(pending->entries, capacity * sizeof(*entries));
+	if(!entries)
+		return true;
+	pending->entries = entries;
+	pending->capacity = capacity;
+	return false;
+}
+
+// `pending_reserve()` must have succeeded first
+static void pending_add(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session, const struct SS *addr) {
+	struct PendingList *pending = &ctx->pending;
+	struct PendingSession *entry = &pending->entries[pending->count++];
+	struct NetAddrKey key = SS_key(addr);
+	memcpy(entry->ip, key.addr, sizeof(entry->ip));
+	entry->room = (uint16_t)indexof(*ctx->rooms, room);
+	entry->id = (playerid_t)indexof((*room)->players, session);
+	++pending->generation;
+	session->pending = true;
+	net_expect_ip(&ctx->net, &key, true); // steers the client's first packets here rather than probing every shard with them
+}
+
+static void pending_remove_at(struct InstanceContext *ctx, uint32_t i) {
+	struct PendingList *pending = &ctx->pending;
+	struct NetAddrKey key = {.port = 0};
+	memcpy(key.addr, pending->entries[i].ip, sizeof(key.addr));
+	net_expect_ip(&ctx->net, &key, false);
+	memmove(&pending->entries[i], &pending->entries[i + 1], (--pending->count - i) * sizeof(*pending->entries));
+}
+
+static void pending_remove(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session) {
+	if(!session->pending)
+		return;
+	session->pending = false;
+	uint16_t roomIndex = (uint16_t)indexof(*ctx->rooms, room);
+	playerid_t id = (playerid_t)indexof((*room)->players, session);
+	for(uint32_t i = 0; i < ctx->pending.count; ++i) {
+		if(ctx->pending.entries[i].room == roomIndex && ctx->pending.entries[i].id == id) {
+			pending_remove_at(ctx, i);
+			return;
+		}
+	}
+}
+
+// Publishes the counts of the second which just ended; the window stays disarmed once a second passes without any
+static void resolveStats_publish(void *userptr, struct TimerNode *node, uint32_t currentTime) {
+	struct InstanceContext *ctx = ((struct NetContext*)userptr)->userptr;
+	const struct InstanceResolveStats current = ctx->resolveStats.current;
+	atomic_store_explicit(&ctx->resolveStats.trials, current.trials, memory_order_relaxed);
+	atomic_store_explicit(&ctx->resolveStats.resolved, current.resolved, memory_order_relaxed);
+	atomic_store_explicit(&ctx->resolveStats.cached, current.cached, memory_order_relaxed);
+	atomic_store_explicit(&ctx->resolveStats.rejected, current.rejected, memory_order_relaxed);
+	atomic_store_explicit(&ctx->resolveStats.migrated, current.migrated, memory_order_relaxed);
+	ctx->resolveStats.current = (struct InstanceResolveStats){0};
+	if(current.trials || current.resolved || current.cached || current.rejected || current.migrated)
+		TimerWheel_arm(&ctx->timers, node, currentTime + 1000);
+}
+
+static void resolveStats_begin(struct InstanceContext *ctx, uint32_t currentTime) {
+	if(!TimerNode_armed(&ctx->resolveStats.window))
+		TimerWheel_arm(&ctx->timers, &ctx->resolveStats.window, currentTime + 1000);
+}
+
 static void room_free(struct InstanceContext *ctx, struct Room **room) {
 	size_t roomID = indexof(*ctx->rooms, room);
+	FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
+		session_index_remove(ctx, room, &(*room)->players[id]);
+		pending_remove(ctx, room, &(*room)->players[id]);
+		TimerWheel_disarm(&ctx->timers, &(*room)->players[id].keepAlive);
+		TimerWheel_disarm(&ctx->timers, &(*room)->players[id].mtuProbe);
+		instance_channels_reset(&(*room)->players[id].channels);
+	}
+	TimerWheel_disarm(&ctx->timers, &(*room)->countdown);
 	net_keypair_free(&(*room)->keys);
 	free(*room);
 	*room = NULL;
@@ -1522,7 +1770,7 @@ static void room_disconnect(struct InstanceContext *ctx, struct Room **room, str
 		struct MenuRpc r_permission = {
 			.type = MenuRpcType_SetPermissionConfiguration,
 			.setPermissionConfiguration = {
-				.base.syncTime = room_get_syncTime(*room),
+				.base.syncTime = room_get_syncTime(ctx, *room),
 				.flags = {true, false, false, false},
 				.playersPermissionConfiguration = room_get_permissions(*room, (*room)->connected, NULL),
 			},
@@ -1546,6 +1794,10 @@ static void room_disconnect(struct InstanceContext *ctx, struct Room **room, str
 		hold = true;
 	}
 
+	session_index_remove(ctx, room, session);
+	pending_remove(ctx, room, session);
+	TimerWheel_disarm(&ctx->timers, &session->keepAlive);
+	TimerWheel_disarm(&ctx->timers, &session->mtuProbe);
 	instance_channels_reset(&session->channels);
 	NetSession_free(&session->net);
 	if(hold)
@@ -1631,6 +1883,7 @@ static inline void handle_packet(struct InstanceContext *ctx, struct Room **room
 			case PacketProperty_Disconnect: room_disconnect(ctx, room, session, false); return;
 			case PacketProperty_UnconnectedMessage: uprintf("BAD PROPERTY: PacketProperty_UnconnectedMessage\n"); break;
 			case PacketProperty_MtuCheck: handle_MtuCheck(&ctx->net, &session->net, &header.mtuCheck); break;
+			case PacketProperty_MtuOk: handle_MtuOk(&session->net, &header.mtuOk); break;
 			case PacketProperty_Merged: uprintf("BAD PROPERTY: PacketProperty_Merged\n"); break;
 			default: uprintf("BAD PACKET PROPERTY\n");
 		}
@@ -1640,6 +1893,7 @@ static inline void handle_packet(struct InstanceContext *ctx, struct Room **room
 }
 
 static const char *instance_masterAddress = NULL;
+static struct NetContext *instance_localMaster = NULL;
 static void *instance_handler(struct InstanceContext *ctx) {
 	net_lock(&ctx->net);
 	if(*instance_masterAddress) {
@@ -1661,13 +1915,16 @@ static void *instance_handler(struct InstanceContext *ctx) {
 		},
 	});
 	uprintf("Started\n");
-	uint8_t pkt[1536];
-	memset(pkt, 0, sizeof(pkt));
+	const uint8_t *pkt;
 	uint32_t len;
 	struct Room **room;
 	struct InstanceSession *session;
-	while((len = net_recv(&ctx->net, pkt, (struct NetSession**)&session, (void**)&room)))
+	while((len = net_recv(&ctx->net, &pkt, (struct NetSession**)&session, (void**)&room))) {
 		handle_packet(ctx, room, session, pkt, &pkt[len]);
+		uint32_t currentTime = ctx->net.clock.ms; // advances once per receive batch
+		if(currentTime != ctx->timers.now) // `net_recv()` only yields to `onResend` once the socket is drained
+			TimerWheel_run(&ctx->timers, currentTime, &ctx->net);
+	}
 	wire_disconnect(&ctx->net, ctx->master);
 	ctx->master = NULL;
 	fail:
@@ -1676,71 +1933,115 @@ static void *instance_handler(struct InstanceContext *ctx) {
 }
 
 // TODO: clients aren't guaranteed to use the same IP address when deeplinking from the master server to instances
-static struct NetSession *instance_onResolve(struct InstanceContext *ctx, struct SS addr, const uint8_t packet[static 1536], uint32_t packet_len, uint8_t out[static 1536], uint32_t *out_len, void **userdata_out) {
-	FOR_ALL_ROOMS(ctx, room) {
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
-			if(!SS_equal(&addr, &(*room)->players[id].net.addr))
-				continue;
-			*out_len = NetSession_decrypt(&(*room)->players[id].net, packet, packet_len, out);
-			*userdata_out = room;
-			return &(*room)->players[id].net;
-		}
+static struct NetSession *instance_onResolve(struct InstanceContext *ctx, struct SS addr, uint8_t *packet, uint32_t packet_len, uint8_t **out, uint32_t *out_len, void **userdata_out) {
+	struct NetAddrKey key = SS_key(&addr);
+	const struct SessionIndexEntry *entry = SessionIndex_find(&ctx->sessionIndex, &key, false);
+	if(entry) {
+		struct Room **room = instance_get_room(ctx, entry->room);
+		*out_len = NetSession_decrypt_inplace(&(*room)->players[entry->id].net, packet, packet_len, out);
+		*userdata_out = room;
+		return &(*room)->players[entry->id].net;
 	}
-	FOR_ALL_ROOMS(ctx, room) {
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
-			if((*room)->players[id].net.addr.ss.ss_family != AF_UNSPEC)
+	struct PendingList *pending = &ctx->pending;
+	uint32_t currentTime = ctx->net.clock.ms;
+	resolveStats_begin(ctx, currentTime);
+	struct PendingMiss *miss = &pending->misses[NetAddrKey_hash(&key) & (lengthof(pending->misses) - 1)];
+	if(miss->generation == pending->generation && currentTime - miss->time < PENDING_MISS_TTL_MS && memcmp(&miss->key, &key, sizeof(key)) == 0) {
+		++ctx->resolveStats.current.cached;
+		return NULL;
+	}
+	// Failed trials must leave `packet` intact for the next candidate (or another shard), so these decrypt into a scratch buffer.
+	uint8_t plain[1536];
+	// A resolved session on the same IP means the client's NAT most likely picked a new port. Only encrypted packets can move a session, since anything else would decrypt against every candidate.
+	const struct NetAddrKey ip = NetAddrKey_ip(key);
+	const struct SessionIndexEntry *candidate;
+	for(uint32_t hash = NetAddrKey_hash(&ip), cursor = 0; packet_len && packet[0] == 1 && (candidate = SessionIndex_next(&ctx->ipIndex, &ip, hash, &cursor));) {
+		struct Room **room = instance_get_room(ctx, candidate->room);
+		struct InstanceSession *session = &(*room)->players[candidate->id];
+		++ctx->resolveStats.current.trials;
+		*out_len = NetSession_decrypt(&session->net, packet, packet_len, plain);
+		if(!*out_len)
+			continue;
+		*out = memcpy(packet, plain, *out_len);
+		char oldstr[INET6_ADDRSTRLEN + 8], addrstr[INET6_ADDRSTRLEN + 8];
+		net_tostr(NetSession_get_addr(&session->net), oldstr);
+		net_tostr(&addr, addrstr);
+		uprintf("migrate %s -> %s (%zu,%hu)@%hhu\n", oldstr, addrstr, indexof(contexts, ctx), indexof(*ctx->rooms, room), candidate->id);
+		session_index_remove(ctx, room, session); // invalidates `candidate`
+		NetSession_set_addr(&session->net, addr);
+		session_index_add(ctx, room, session);
+		++ctx->resolveStats.current.migrated;
+		*userdata_out = room;
+		return &session->net;
+	}
+	// Sessions the master saw connecting from the same IP go first, then everything else; newest allocations first in both passes.
+	for(uint32_t pass = 0; pass < 2; ++pass) {
+		for(uint32_t i = pending->count; i--;) {
+			const struct PendingSession *entry = &pending->entries[i];
+			if((memcmp(entry->ip, key.addr, sizeof(key.addr)) == 0) != (pass == 0))
 				continue;
-			*out_len = NetSession_decrypt(&(*room)->players[id].net, packet, packet_len, out);
+			struct Room **room = instance_get_room(ctx, entry->room);
+			playerid_t id = entry->id;
+			++ctx->resolveStats.current.trials;
+			*out_len = NetSession_decrypt(&(*room)->players[id].net, packet, packet_len, plain);
 			if(!*out_len)
 				continue;
+			*out = memcpy(packet, plain, *out_len);
 			char addrstr[INET6_ADDRSTRLEN + 8];
 			net_tostr(&addr, addrstr);
 			uprintf("resolve %s -> (%zu,%hu)@%hhu\n", addrstr, indexof(contexts, ctx), indexof(*ctx->rooms, room), id);
+			pending_remove_at(ctx, i);
+			(*room)->players[id].pending = false;
 			(*room)->players[id].net.addr = addr;
+			session_index_add(ctx, room, &(*room)->players[id]);
+			++ctx->resolveStats.current.resolved;
 			*userdata_out = room;
 			return &(*room)->players[id].net;
 		}
 	}
+	*miss = (struct PendingMiss){
+		.key = key,
+		.generation = pending->generation,
+		.time = currentTime,
+	};
+	++ctx->resolveStats.current.rejected;
 	return NULL;
 }
 
-static uint32_t instance_onResend(struct InstanceContext *ctx, uint32_t currentTime) {
-	int32_t nextTick = 180000;
-	FOR_ALL_ROOMS(ctx, room) {
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
-			struct InstanceSession *session = &(*room)->players[id];
-			int32_t kickTime = (int32_t)(NetSession_get_lastKeepAlive(&session->net) + IDLE_TIMEOUT_MS - currentTime);
-			if(kickTime < 0) {
-				uprintf("session timeout\n");
-				room_disconnect(ctx, room, session, false);
-				continue;
-			}
-			if(kickTime < nextTick)
-				nextTick = kickTime;
-			nextTick = (int32_t)instance_channels_tick(&session->channels, &ctx->net, &session->net, currentTime); // TODO: proper resend timing
-		}
-		if(!*room)
-			continue;
-
-		if((*room)->state & ServerState_Timeout) {
-			float delta = (*room)->global.timeout - room_get_syncTime(*room);
-			if(delta > 0) {
-				uint32_t ms = (uint32_t)(delta * 1000);
-				if(ms < 10)
-					ms = 10;
-				if(ms < (uint32_t)nextTick)
-					nextTick = (int32_t)ms;
-			} else if((*room)->state & ServerState_Game_Results) { // TODO: ServerState_Lobby_Results = ServerState_Lobby_Idle >> 1
-				room_set_state(ctx, *room, ServerState_Lobby_Idle);
-			} else {
-				room_set_state(ctx, *room, (ServerState)((*room)->state << 1));
-			}
-		}
+static void session_mtuProbe_send(void *userptr, struct TimerNode *node, uint32_t currentTime) {
+	struct InstanceContext *ctx = ((struct NetContext*)userptr)->userptr;
+	struct InstanceSession *session = (struct InstanceSession*)((uint8_t*)node - offsetof(struct InstanceSession, mtuProbe));
+	if(net_probe_mtu(&ctx->net, &session->net)) // re-armed until the largest size is confirmed or the probes time out
+		TimerWheel_arm(&ctx->timers, node, currentTime + MTU_PROBE_INTERVAL_MS);
+}
 
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,)
-			net_flush_merged(&ctx->net, &(*room)->players[id].net);
+static void session_keepAlive_expire(void *userptr, struct TimerNode *node, uint32_t currentTime) {
+	struct InstanceContext *ctx = ((struct NetContext*)userptr)->userptr;
+	struct InstanceSession *session = (struct InstanceSession*)((uint8_t*)node - offsetof(struct InstanceSession, keepAlive));
+	uint32_t deadline = NetSession_get_lastKeepAlive(&session->net) + IDLE_TIMEOUT_MS;
+	if((int32_t)(deadline - currentTime) > 0) {
+		TimerWheel_arm(&ctx->timers, node, deadline);
+		return;
 	}
-	return (uint32_t)nextTick;
+	uprintf("session timeout\n");
+	room_disconnect(ctx, node->owner, session, false);
+}
+
+static void room_countdown_expire(void *userptr, struct TimerNode *node, uint32_t) {
+	struct InstanceContext *ctx = ((struct NetContext*)userptr)->userptr;
+	struct Room *room = *(struct Room**)node->owner;
+	if(room->global.timeout - room_get_syncTime(ctx, room) > 0)
+		room_arm_countdown(ctx, room);
+	else if(room->state & ServerState_Game_Results) // TODO: ServerState_Lobby_Results = ServerState_Lobby_Idle >> 1
+		room_set_state(ctx, room, ServerState_Lobby_Idle);
+	else
+		room_set_state(ctx, room, (ServerState)(room->state << 1));
+}
+
+static uint32_t instance_onResend(struct InstanceContext *ctx, uint32_t currentTime) {
+	TimerWheel_run(&ctx->timers, currentTime, &ctx->net);
+	uint32_t nextTick = TimerWheel_next(&ctx->timers);
+	return (nextTick < 180000) ? nextTick : 180000;
 }
 
 static const char *instance_domainIPv4 = NULL, *instance_domain = NULL;
@@ -1795,8 +2096,7 @@ static struct Room **room_open(struct InstanceContext *ctx, uint32_t roomID, str
 	net_keypair_init(&ctx->net, &room->keys);
 	room->serverOwner = 0;
 	room->configuration = configuration;
-	if(clock_gettime(CLOCK_MONOTONIC, &room->syncBase))
-		room->syncBase = (struct timespec){0};
+	room->syncBase = ctx->net.clock.mono;
 	room->shortCountdown = 5;
 	room->longCountdown = 15;
 	room->skipResults = false;
@@ -1813,6 +2113,10 @@ static struct Room **room_open(struct InstanceContext *ctx, uint32_t roomID, str
 	room->global.selectedBeatmap = CLEAR_BEATMAP;
 	room->global.selectedModifiers = CLEAR_MODIFIERS;
 	room->global.roundRobin = 0;
+	room->countdown = (struct TimerNode){
+		.callback = room_countdown_expire,
+		.owner = instance_get_room(ctx, roomID),
+	};
 	if(instance_mapPool) {
 		room->serverOwner = (playerid_t)room->configuration.maxPlayerCount;
 		room->players[room->configuration.maxPlayerCount].userId = String_from("");
@@ -1841,11 +2145,16 @@ static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *
 	struct Room *room = *instance_get_room(ctx, req->room);
 	if(room == NULL)
 		return (struct WireSessionAllocResp){.result = ConnectToServerResponse_Result_UnknownError};
+	if(pending_reserve(ctx)) {
+		uprintf("alloc error\n");
+		return (struct WireSessionAllocResp){.result = ConnectToServerResponse_Result_UnknownError};
+	}
 	struct SS addr = {.len = req->address.length};
 	memcpy(&addr.ss, req->address.data, req->address.length);
-	FOR_SOME_PLAYERS(id, room->playerSort,)
-		if(SS_equal(NetSession_get_addr(&room->players[id].net), &addr))
-			room_disconnect(ctx, &room, &room->players[id], true);
+	struct NetAddrKey key = SS_key(&addr);
+	const struct SessionIndexEntry *entry = SessionIndex_find(&ctx->sessionIndex, &key, false);
+	if(entry && entry->room == req->room)
+		room_disconnect(ctx, instance_get_room(ctx, req->room), &room->players[entry->id], true);
 	struct InstanceSession *session = NULL;
 	{
 		struct CounterP tmp = room->playerSort;
@@ -1868,7 +2177,18 @@ static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *
 		.joinOrder = ++room->joinCount,
 		.avatar = CLEAR_AVATARDATA,
 	};
-	instance_channels_init(&session->channels);
+	instance_channels_init(&session->channels, &ctx->timers, &session->net);
+	instance_channels_schedule(&session->channels);
+	pending_add(ctx, instance_get_room(ctx, req->room), session, &addr);
+	session->keepAlive = (struct TimerNode){
+		.callback = session_keepAlive_expire,
+		.owner = instance_get_room(ctx, req->room),
+	};
+	TimerWheel_arm(&ctx->timers, &session->keepAlive, NetSession_get_lastKeepAlive(&session->net) + IDLE_TIMEOUT_MS);
+	session->mtuProbe = (struct TimerNode){
+		.callback = session_mtuProbe_send,
+		.owner = instance_get_room(ctx, req->room),
+	};
 
 	bool ipv4 = (addr.ss.ss_family != AF_INET6 || memcmp(addr.in6.sin6_addr.s6_addr, (const uint16_t[]){0,0,0,0,0,0xffff}, 12) == 0);
 	struct WireSessionAllocResp resp = {
@@ -1938,32 +2258,62 @@ static void instance_onWireMessage(struct InstanceContext *ctx, union WireLink *
 
 static uint32_t threads_len = 0;
 static pthread_t *threads = NULL;
-bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count) {
+static struct NetShardGroup **shardGroups = NULL;
+bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count, uint32_t shards) {
 	if(mapPoolFile && *mapPoolFile)
 		mapPool_init(mapPoolFile);
 	instance_domainIPv4 = domainIPv4;
 	instance_domain = domain;
 	instance_masterAddress = remoteMaster;
+	instance_localMaster = localMaster;
 	threads_len = 0;
 	contexts = malloc(count * sizeof(*contexts));
 	threads = malloc(count * sizeof(*threads));
-	if(!contexts || !threads) {
+	shardGroups = calloc(count, sizeof(*shardGroups));
+	if(!contexts || !threads || !shardGroups) {
 		uprintf("alloc error\n");
 		return true;
 	}
+	if(shards < 1)
+		shards = 1;
 	for(; threads_len < count; ++threads_len) {
 		struct InstanceContext *ctx = &contexts[threads_len];
-		if(net_init(&ctx->net, (uint16_t)(5000 + threads_len), true, 16)) {
-			uprintf("net_init() failed\n");
-			return true;
+		uint32_t group = threads_len / shards, shard = threads_len % shards;
+		uint16_t port = (uint16_t)(5000 + group);
+		if(shards == 1) {
+			if(net_init(&ctx->net, port, true, 16)) {
+				uprintf("net_init() failed\n");
+				return true;
+			}
+		} else {
+			if(shard == 0) {
+				shardGroups[group] = net_shard_group_new((count - threads_len < shards) ? count - threads_len : shards);
+				if(!shardGroups[group])
+					return true;
+			}
+			if(net_init_shard(&ctx->net, shardGroups[group], port, true, shard ? 0 : 16)) {
+				uprintf("net_init_shard() failed\n");
+				return true;
+			}
 		}
 		ctx->net.userptr = &contexts[threads_len];
-		ctx->net.onResolve = (struct NetSession *(*)(void*, struct SS, const uint8_t*, uint32_t, uint8_t*, uint32_t*, void**))instance_onResolve;
+		ctx->net.onResolve = (struct NetSession *(*)(void*, struct SS, uint8_t*, uint32_t, uint8_t**, uint32_t*, void**))instance_onResolve;
 		ctx->net.onResend = (uint32_t (*)(void*, uint32_t))instance_onResend;
 		ctx->net.onWireMessage = (void (*)(void*, union WireLink*, const struct WireMessage*))instance_onWireMessage;
 		ctx->roomMask = COUNTER64_CLEAR;
 		ctx->master = (union WireLink*)localMaster;
 		memset(ctx->rooms, 0, sizeof(ctx->rooms));
+		ctx->sessionIndex = (struct SessionIndex){0};
+		ctx->ipIndex = (struct SessionIndex){0};
+		ctx->pending = (struct PendingList){0};
+		TimerWheel_init(&ctx->timers, net_time());
+		ctx->resolveStats.window = (struct TimerNode){.callback = resolveStats_publish};
+		ctx->resolveStats.current = (struct InstanceResolveStats){0};
+		atomic_init(&ctx->resolveStats.trials, 0);
+		atomic_init(&ctx->resolveStats.resolved, 0);
+		atomic_init(&ctx->resolveStats.cached, 0);
+		atomic_init(&ctx->resolveStats.rejected, 0);
+		atomic_init(&ctx->resolveStats.migrated, 0);
 
 		if(pthread_create(&threads[threads_len], NULL, (void *(*)(void*))instance_handler, ctx))
 			threads[threads_len] = 0;
@@ -1976,6 +2326,49 @@ bool instance_init(const char *domainIPv4, const char *domain, const char *remot
 	return false;
 }
 
+void instance_get_resolveStats(struct InstanceResolveStats *out) {
+	*out = (struct InstanceResolveStats){0};
+	for(uint32_t i = 0; i < threads_len; ++i) {
+		if(!threads[i])
+			continue;
+		struct InstanceContext *ctx = &contexts[i];
+		out->trials += atomic_load_explicit(&ctx->resolveStats.trials, memory_order_relaxed);
+		out->resolved += atomic_load_explicit(&ctx->resolveStats.resolved, memory_order_relaxed);
+		out->cached += atomic_load_explicit(&ctx->resolveStats.cached, memory_order_relaxed);
+		out->rejected += atomic_load_explicit(&ctx->resolveStats.rejected, memory_order_relaxed);
+		out->migrated += atomic_load_explicit(&ctx->resolveStats.migrated, memory_order_relaxed);
+	}
+}
+
+void instance_get_pingStats(struct NetPingStats *out) {
+	*out = (struct NetPingStats){0};
+	for(uint32_t i = 0; i < threads_len; ++i) {
+		if(!threads[i])
+			continue;
+		struct NetPingStats stats;
+		net_get_pingStats(&contexts[i].net, &stats);
+		out->answered += stats.answered;
+		out->limited += stats.limited;
+		out->stray += stats.stray;
+	}
+}
+
+uint32_t instance_get_latencyStats(struct NetLatencyStats *out, uint32_t out_len) {
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < threads_len && count < out_len; ++i)
+		if(threads[i])
+			net_get_latencyStats(&contexts[i].net, &out[count++]);
+	return count;
+}
+
+uint32_t instance_get_socketStats(struct NetSocketStats *out, uint32_t out_len) {
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < threads_len && count < out_len; ++i)
+		if(threads[i])
+			net_get_socketStats(&contexts[i].net, &out[count++]);
+	return count;
+}
+
 void instance_cleanup() {
 	for(uint32_t i = 0; i < threads_len; ++i) {
 		if(threads[i]) {
@@ -1984,6 +2377,8 @@ void instance_cleanup() {
 			uprintf("Stopping #%u\n", i);
 			pthread_join(threads[i], NULL);
 			threads[i] = 0;
+			if(instance_localMaster) // the master may still post to this context until it has seen the disconnect
+				net_sync(instance_localMaster);
 			FOR_ALL_ROOMS(ctx, room) {
 				FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
 					instance_channels_reset(&(*room)->players[id].channels);
@@ -1993,11 +2388,25 @@ void instance_cleanup() {
 			}
 			ctx->roomMask = COUNTER64_CLEAR; // should be redundant, but just to be safe
 			memset(ctx->rooms, 0, sizeof(ctx->rooms));
+			free(ctx->sessionIndex.entries);
+			ctx->sessionIndex = (struct SessionIndex){0};
+			free(ctx->ipIndex.entries);
+			ctx->ipIndex = (struct SessionIndex){0};
+			free(ctx->pending.entries);
+			ctx->pending.entries = NULL;
+			ctx->pending.count = ctx->pending.capacity = 0;
 			net_cleanup(&ctx->net);
 		}
 	}
+	if(shardGroups)
+		for(uint32_t i = 0; i < threads_len; ++i)
+			net_shard_group_free(shardGroups[i]);
 	free(instance_mapPool);
+	free(shardGroups);
 	free(threads);
 	free(contexts);
+	threads_len = 0;
 	instance_mapPool = NULL;
+	instance_localMaster = NULL;
+	shardGroups = NULL;
 }
@@ -1,5 +1,17 @@
 #pragma once
 #include "../net.h"
 
-bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count);
+struct InstanceResolveStats { // per second, summed over all instance threads
+	uint32_t trials; // `NetSession_decrypt()` calls against pending sessions
+	uint32_t resolved; // pending sessions bound to an address
+	uint32_t cached; // packets dropped by the negative cache without decrypting
+	uint32_t rejected; // packets which failed against every pending session
+	uint32_t migrated; // resolved sessions moved to a new port on the same IP
+};
+
+bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count, uint32_t shards);
 void instance_cleanup(void);
+void instance_get_resolveStats(struct InstanceResolveStats *out);
+void instance_get_pingStats(struct NetPingStats *out); // totals since startup
+uint32_t instance_get_latencyStats(struct NetLatencyStats *out, uint32_t out_len); // one entry per instance thread, totals since startup
+uint32_t instance_get_socketStats(struct NetSocketStats *out, uint32_t out_len); // one entry per instance thread
@@ -0,0 +1,139 @@
+#include "timer.h"
+
+#define TIMER_EXPIRED UINT16_MAX
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+static inline uint32_t level_shift(uint32_t level) {
+	return level * TIMER_SLOT_BITS;
+}
+
+static void TimerNode_link(struct TimerNode **head, struct TimerNode *node) {
+	node->next = *head;
+	node->prev = head;
+	if(*head)
+		(*head)->prev = &node->next;
+	*head = node;
+}
+
+static void TimerWheel_place(struct TimerWheel *wheel, struct TimerNode *node) {
+	int32_t delta = (int32_t)(node->deadline - wheel->now);
+	if(delta <= 0) {
+		node->bucket = TIMER_EXPIRED;
+		node->next = NULL;
+		node->prev = wheel->expired_end;
+		*wheel->expired_end = node;
+		wheel->expired_end = &node->next;
+		return;
+	}
+	uint32_t level = 0;
+	while(level < TIMER_LEVELS - 1 && (uint32_t)delta >> level_shift(level + 1))
+		++level;
+	uint32_t slot = (node->deadline >> level_shift(level)) & TIMER_MASK;
+	node->bucket = (uint16_t)(level * TIMER_SLOTS + slot);
+	TimerNode_link(&wheel->slots[level][slot], node);
+	wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+void TimerWheel_init(struct TimerWheel *wheel, uint32_t currentTime) {
+	*wheel = (struct TimerWheel){
+		.now = currentTime,
+		.expired_end = &wheel->expired,
+	};
+}
+
+void TimerWheel_disarm(struct TimerWheel *wheel, struct TimerNode *node) {
+	if(!node->prev)
+		return;
+	*node->prev = node->next;
+	if(node->next)
+		node->next->prev = node->prev;
+	if(node->bucket == TIMER_EXPIRED) {
+		if(wheel->expired_end == &node->next)
+			wheel->expired_end = node->prev;
+	} else {
+		uint32_t level = node->bucket / TIMER_SLOTS, slot = node->bucket % TIMER_SLOTS;
+		if(!wheel->slots[level][slot])
+			wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+	}
+	node->next = NULL;
+	node->prev = NULL;
+	--wheel->count;
+}
+
+void TimerWheel_arm(struct TimerWheel *wheel, struct TimerNode *node, uint32_t deadline) {
+	TimerWheel_disarm(wheel, node);
+	node->deadline = deadline;
+	TimerWheel_place(wheel, node);
+	++wheel->count;
+}
+
+// Moves every entry of a slot either down the wheel or onto the expired list
+static void TimerWheel_cascade(struct TimerWheel *wheel, uint32_t level, uint32_t slot) {
+	struct TimerNode *it = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+	wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+	while(it) {
+		struct TimerNode *next = it->next;
+		TimerWheel_place(wheel, it);
+		it = next;
+	}
+}
+
+static void TimerWheel_advance(struct TimerWheel *wheel, uint32_t currentTime) {
+	if(!wheel->count) {
+		wheel->now = currentTime;
+		return;
+	}
+	for(;;) {
+		TimerWheel_cascade(wheel, 0, wheel->now & TIMER_MASK);
+		int32_t remaining = (int32_t)(currentTime - wheel->now);
+		if(remaining <= 0)
+			return;
+		// Skip straight to the next occupied slot in this revolution, or to the next revolution if there is none
+		uint32_t slot = wheel->now & TIMER_MASK;
+		uint64_t ahead = (slot == TIMER_MASK) ? 0 : wheel->occupied[0] >> (slot + 1) << (slot + 1);
+		uint32_t step = ahead ? (uint32_t)__builtin_ctzll(ahead) - slot : TIMER_SLOTS - slot;
+		if(step > (uint32_t)remaining)
+			step = (uint32_t)remaining;
+		wheel->now += step;
+		for(uint32_t level = 1; level < TIMER_LEVELS; ++level) {
+			if(wheel->now & ((UINT32_C(1) << level_shift(level)) - 1))
+				break;
+			uint32_t index = (wheel->now >> level_shift(level)) & TIMER_MASK;
+			TimerWheel_cascade(wheel, level, index);
+			if(index)
+				break;
+		}
+	}
+}
+
+void TimerWheel_run(struct TimerWheel *wheel, uint32_t currentTime, void *userptr) {
+	TimerWheel_advance(wheel, currentTime);
+	while(wheel->expired) {
+		struct TimerNode *node = wheel->expired;
+		TimerWheel_disarm(wheel, node);
+		node->callback(userptr, node, currentTime);
+	}
+}
+
+uint32_t TimerWheel_next(const struct TimerWheel *wheel) {
+	if(wheel->expired)
+		return 0;
+	uint32_t next = UINT32_MAX;
+	for(uint32_t level = 0; level < TIMER_LEVELS; ++level) {
+		if(!wheel->occupied[level])
+			continue;
+		// Slots are visited in order starting after the current one; level 0 expires on arrival, higher levels cascade
+		uint32_t shift = level_shift(level), index = (wheel->now >> shift) & TIMER_MASK;
+		uint64_t rotated = index ? (wheel->occupied[level] >> index) | (wheel->occupied[level] << (TIMER_SLOTS - index)) : wheel->occupied[level];
+		if(level && (rotated & ~UINT64_C(1))) // the current slot was already cascaded this revolution
+			rotated &= ~UINT64_C(1);
+		uint32_t distance = (uint32_t)__builtin_ctzll(rotated);
+		if(level && !distance)
+			distance = TIMER_SLOTS;
+		uint32_t due = level ? ((wheel->now >> shift) + distance) << shift : wheel->now + distance;
+		if(due - wheel->now < next)
+			next = due - wheel->now;
+	}
+	return next;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "../global.h"
+#include <stdbool.h>
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1u << TIMER_SLOT_BITS)
+
+// Intrusive entry; zero-initialized nodes are disarmed
+struct TimerNode {
+	struct TimerNode *next, **prev; // `prev` is NULL while disarmed
+	uint32_t deadline;
+	uint16_t bucket; // `level * TIMER_SLOTS + slot`, or `TIMER_EXPIRED`
+	void (*callback)(void *userptr, struct TimerNode *node, uint32_t currentTime);
+	void *owner;
+};
+
+// Hierarchical timing wheel with millisecond resolution. Level `n` covers deadlines up to `64^(n+1)` ms away; entries move down a level each time their slot comes up.
+struct TimerWheel {
+	uint32_t now; // time the wheel has been advanced to
+	uint32_t count;
+	uint64_t occupied[TIMER_LEVELS];
+	struct TimerNode *slots[TIMER_LEVELS][TIMER_SLOTS];
+	struct TimerNode *expired, **expired_end; // due, waiting for `TimerWheel_run()` to invoke them
+};
+
+void TimerWheel_init(struct TimerWheel *wheel, uint32_t currentTime);
+void TimerWheel_arm(struct TimerWheel *wheel, struct TimerNode *node, uint32_t deadline); // re-arms if already pending
+void TimerWheel_disarm(struct TimerWheel *wheel, struct TimerNode *node);
+void TimerWheel_run(struct TimerWheel *wheel, uint32_t currentTime, void *userptr); // invokes the callback of every expired node
+uint32_t TimerWheel_next(const struct TimerWheel *wheel); // milliseconds until the next callback is due, or UINT32_MAX if nothing is armed
+
+static inline bool TimerNode_armed(const struct TimerNode *node) {
+	return node->prev != NULL;
+}
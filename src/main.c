@@ -38,6 +38,14 @@ int main(int argc, const char *argv[]) {
 	if(config_load(&cfg, config_path)) // TODO: live config reloading
 		goto fail0;
 	wire_set_key(cfg.wireKey, cfg.wireKey_len);
+	net_useUring = cfg.netUring;
+	net_useGro = cfg.netGro;
+	net_recvBatch = cfg.netRecvBatch;
+	net_usePinger = cfg.netPinger;
+	net_pingRate = cfg.netPingRate;
+	net_recvBuffer = (uint32_t)cfg.netRecvBuffer * 1024u;
+	net_sendBuffer = (uint32_t)cfg.netSendBuffer * 1024u;
+	net_autoTune = cfg.netAutoTune;
 	if(cfg.statusPort) {
 		status_internal_init();
 		if(mbedtls_pk_get_type(&cfg.statusKey) != MBEDTLS_PK_NONE) {
@@ -54,7 +62,7 @@ int main(int argc, const char *argv[]) {
 		if(!localMaster)
 			goto fail3;
 	}
-	if(instance_init(cfg.instanceAddress[0], cfg.instanceAddress[1], cfg.instanceParent, localMaster, cfg.instanceMapPool, cfg.instanceCount))
+	if(instance_init(cfg.instanceAddress[0], cfg.instanceAddress[1], cfg.instanceParent, localMaster, cfg.instanceMapPool, cfg.instanceCount, cfg.instanceShards))
 		goto fail4;
 	if(headless) {
 		#ifndef WINDOWS
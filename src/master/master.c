@@ -2,11 +2,13 @@
 #include "master.h"
 #include "pool.h"
 #include "../counter.h"
+#include <mbedtls/md.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MASTER_SERIALIZE(data, pkt, end) pkt_serialize(data, pkt, end, PV_LEGACY_DEFAULT)
+#define MASTER_COOKIE_BUCKET_MS 30000 // HelloVerifyRequest cookies stay valid for one to two buckets
 
 struct HandshakeState {
 	uint32_t certificateRequestId;
@@ -47,6 +49,7 @@ struct Context {
 	const mbedtls_x509_crt *cert;
 	const mbedtls_pk_context *key;
 	struct MasterSession *sessionList;
+	uint8_t cookieSecret[32];
 };
 
 static struct MasterSession *master_lookup_session(struct Context *ctx, struct SS addr) {
@@ -56,27 +59,113 @@ static struct MasterSession *master_lookup_session(struct Context *ctx, struct S
 	return NULL;
 }
 
-static struct NetSession *master_onResolve(struct Context *ctx, struct SS addr, const uint8_t packet[static 1536], uint32_t packet_len, uint8_t out[static 1536], uint32_t *out_len, void**) {
+// HMAC of the client's address and random under a per-process secret, so a client proves it can receive at its address before anything is allocated for it
+static struct Cookie32 master_cookie(const struct Context *ctx, const struct SS *addr, uint32_t bucket, const struct Cookie32 *random) {
+	struct {
+		struct NetAddrKey addr;
+		uint32_t bucket;
+		struct Cookie32 random;
+	} input;
+	memset(&input, 0, sizeof(input));
+	input.addr = SS_key(addr);
+	input.bucket = bucket;
+	input.random = *random;
+	struct Cookie32 out;
+	mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), ctx->cookieSecret, sizeof(ctx->cookieSecret), (const uint8_t*)&input, sizeof(input), out.raw);
+	return out;
+}
+
+static bool master_cookie_valid(const struct Context *ctx, const struct SS *addr, const struct Cookie32 *random, const struct Cookie32 *cookie) {
+	uint32_t bucket = ctx->net.clock.ms / MASTER_COOKIE_BUCKET_MS;
+	for(uint32_t age = 0; age < 2; ++age) {
+		struct Cookie32 expected = master_cookie(ctx, addr, bucket - age, random);
+		if(memcmp(expected.raw, cookie->raw, sizeof(expected.raw)) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void master_send_HelloVerifyRequest(struct Context *ctx, const struct SS *addr, uint8_t protocolVersion, const struct ClientHelloRequest *req) {
+	uint8_t resp[65536], *resp_end = resp;
+	bool res = pkt_write_c(&resp_end, endof(resp), PV_LEGACY_DEFAULT, NetPacketHeader, {
+		.property = PacketProperty_UnconnectedMessage,
+		.unconnectedMessage = {
+			.type = MessageType_HandshakeMessage,
+			.protocolVersion = protocolVersion,
+		},
+	}) && MASTER_SERIALIZE((&(struct HandshakeMessage){
+		.type = HandshakeMessageType_HelloVerifyRequest,
+		.helloVerifyRequest = {
+			.base.responseId = req->base.requestId,
+			.cookie = master_cookie(ctx, addr, ctx->net.clock.ms / MASTER_COOKIE_BUCKET_MS, &req->random),
+		},
+	}), &resp_end, endof(resp));
+	if(res)
+		net_send_unconnected(&ctx->net, addr, resp, (uint32_t)(resp_end - resp)); // unreliable; the client resends its hello until it gets an answer
+}
+
+static struct MasterSession *master_create_session(struct Context *ctx, struct SS addr) {
+	struct MasterSession *session = malloc(sizeof(struct MasterSession));
+	if(!session) {
+		uprintf("alloc error\n");
+		abort();
+	}
+	NetSession_init(&ctx->net, &session->net, addr);
+	session->lastSentRequestId = 0;
+	session->handshake.step = HandshakeMessageType_ClientHelloRequest;
+	session->resend.set = COUNTER64_CLEAR;
+	session->multipartList = NULL;
+	session->next = ctx->sessionList;
+	ctx->sessionList = session;
+
+	char addrstr[INET6_ADDRSTRLEN + 8];
+	net_tostr(&addr, addrstr);
+	uprintf("connect %s\n", addrstr);
+	return session;
+}
+
+// Handshake traffic from addresses without a session. ClientHelloRequest is answered without keeping any state, and only a ClientHelloWithCookieRequest echoing a valid cookie gets a session (and with it, a keypair).
+static struct MasterSession *master_resolve_stateless(struct Context *ctx, struct SS addr, const uint8_t *packet, uint32_t packet_len) {
+	const uint8_t *data = packet, *end = &packet[packet_len];
+	struct PacketEncryptionLayer layer;
+	struct NetPacketHeader header;
+	struct SerializeHeader serial;
+	if(!pkt_read(&layer, &data, end, PV_LEGACY_DEFAULT) || layer.encrypted)
+		return NULL;
+	if(!pkt_read(&header, &data, end, PV_LEGACY_DEFAULT) || header.property != PacketProperty_UnconnectedMessage || header.unconnectedMessage.type != MessageType_HandshakeMessage)
+		return NULL;
+	struct PacketContext version = PV_LEGACY_DEFAULT;
+	if(header.unconnectedMessage.protocolVersion > version.protocolVersion)
+		version.protocolVersion = (uint8_t)header.unconnectedMessage.protocolVersion;
+	if(!pkt_read(&serial, &data, end, version) || serial.length > (uintptr_t)(end - data))
+		return NULL;
+	struct HandshakeMessage message = {.type = (HandshakeMessageType)UINT32_C(0xffffffff)};
+	if(!pkt_read(&message, &data, &data[serial.length], version))
+		return NULL;
+	if(message.type == HandshakeMessageType_ClientHelloRequest) {
+		master_send_HelloVerifyRequest(ctx, &addr, version.protocolVersion, &message.clientHelloRequest);
+		return NULL;
+	}
+	if(message.type != HandshakeMessageType_ClientHelloWithCookieRequest)
+		return NULL;
+	const struct ClientHelloWithCookieRequest *req = &message.clientHelloWithCookieRequest;
+	if(!master_cookie_valid(ctx, &addr, &req->random, &req->cookie))
+		return NULL;
+	struct MasterSession *session = master_create_session(ctx, addr);
+	session->epoch = req->base.requestId & 0xff000000;
+	session->net.clientRandom = req->random;
+	session->handshake.step = HandshakeMessageType_ClientHelloWithCookieRequest;
+	return session;
+}
+
+static struct NetSession *master_onResolve(struct Context *ctx, struct SS addr, uint8_t *packet, uint32_t packet_len, uint8_t **out, uint32_t *out_len, void**) {
 	struct MasterSession *session = master_lookup_session(ctx, addr);
 	if(session == NULL) {
-		session = malloc(sizeof(struct MasterSession));
-		if(!session) {
-			uprintf("alloc error\n");
-			abort();
-		}
-		NetSession_init(&ctx->net, &session->net, addr);
-		session->lastSentRequestId = 0;
-		session->handshake.step = HandshakeMessageType_ClientHelloRequest;
-		session->resend.set = COUNTER64_CLEAR;
-		session->multipartList = NULL;
-		session->next = ctx->sessionList;
-		ctx->sessionList = session;
-
-		char addrstr[INET6_ADDRSTRLEN + 8];
-		net_tostr(&addr, addrstr);
-		uprintf("connect %s\n", addrstr);
+		session = master_resolve_stateless(ctx, addr, packet, packet_len);
+		if(session == NULL)
+			return NULL;
 	}
-	*out_len = NetSession_decrypt(&session->net, packet, packet_len, out);
+	*out_len = NetSession_decrypt_inplace(&session->net, packet, packet_len, out);
 	return &session->net;
 }
 
@@ -145,7 +234,7 @@ static void master_send_internal(struct NetContext *ctx, struct MasterSession *s
 	uint32_t i = Counter64_set_next(&session->resend.set);
 	if(i != COUNTER64_INVALID) {
 		struct MasterPacket *slot = &session->resend.slots[i];
-		slot->timeStamp = net_time();
+		slot->timeStamp = ctx->clock.ms;
 		slot->length = length;
 		slot->encrypt = encrypt;
 		memcpy(slot->data, buf, length);
@@ -236,35 +325,25 @@ static void master_send_ack(struct Context *ctx, struct MasterSession *session,
 		net_send_internal(&ctx->net, &session->net, resp, (uint32_t)(resp_end - resp), type != MessageType_HandshakeMessage);
 }
 
+// The existing session is left alone until the client comes back with a valid cookie
 static void handle_ClientHelloRequest(struct Context *ctx, struct MasterSession *session, const struct ClientHelloRequest *req) {
-	if(session->handshake.step != HandshakeMessageType_ClientHelloRequest) {
-		if(net_time() - NetSession_get_lastKeepAlive(&session->net) < 5000) // 5 second timeout to prevent clients from getting "locked out" if their previous session hasn't closed or timed out yet
+	master_send_HelloVerifyRequest(ctx, NetSession_get_addr(&session->net), session->net.version.protocolVersion, req);
+}
+
+static void handle_ClientHelloWithCookieRequest(struct Context *ctx, struct MasterSession *session, const struct ClientHelloWithCookieRequest *req) {
+	if(!master_cookie_valid(ctx, NetSession_get_addr(&session->net), &req->random, &req->cookie))
+		return;
+	master_send_ack(ctx, session, MessageType_HandshakeMessage, req->base.requestId);
+	if(session->handshake.step != HandshakeMessageType_ClientHelloWithCookieRequest) {
+		if(ctx->net.clock.ms - NetSession_get_lastKeepAlive(&session->net) < 5000) // 5 second timeout to prevent clients from getting "locked out" if their previous session hasn't closed or timed out yet
 			return;
 		struct SS addr = *NetSession_get_addr(&session->net);
 		NetSession_free(&session->net);
 		NetSession_init(&ctx->net, &session->net, addr); // security or something idk
 		session->resend.set = COUNTER64_CLEAR;
+		session->epoch = req->base.requestId & 0xff000000;
+		session->net.clientRandom = req->random;
 	}
-	session->epoch = req->base.requestId & 0xff000000;
-	session->net.clientRandom = req->random;
-	struct HandshakeMessage r_hello = {
-		.type = HandshakeMessageType_HelloVerifyRequest,
-		.helloVerifyRequest.base.responseId = req->base.requestId,
-	};
-	r_hello.helloVerifyRequest.cookie = *NetSession_get_cookie(&session->net);
-	uint8_t resp[65536], *resp_end = resp;
-	if(!MASTER_SERIALIZE(&r_hello, &resp_end, endof(resp)))
-		return;
-	master_send(&ctx->net, session, MessageType_HandshakeMessage, resp, resp_end); // TODO: this should not be sent reliably
-	session->handshake.step = HandshakeMessageType_ClientHelloWithCookieRequest;
-}
-
-static void handle_ClientHelloWithCookieRequest(struct Context *ctx, struct MasterSession *session, const struct ClientHelloWithCookieRequest *req) {
-	master_send_ack(ctx, session, MessageType_HandshakeMessage, req->base.requestId);
-	if(session->handshake.step != HandshakeMessageType_ClientHelloWithCookieRequest)
-		return;
-	if(memcmp(req->cookie.raw, NetSession_get_cookie(&session->net)->raw, sizeof(req->cookie.raw)) != 0)
-		return;
 	if(memcmp(req->random.raw, session->net.clientRandom.raw, sizeof(req->random.raw)) != 0)
 		return;
 
@@ -697,11 +776,10 @@ static void handle_packet(struct Context *ctx, struct MasterSession *session, st
 static void *master_handler(struct Context *ctx) {
 	net_lock(&ctx->net);
 	uprintf("Started\n");
-	uint8_t pkt[1536];
-	memset(pkt, 0, sizeof(pkt));
+	const uint8_t *pkt;
 	uint32_t len;
 	struct MasterSession *session;
-	while((len = net_recv(&ctx->net, pkt, (struct NetSession**)&session, NULL))) {
+	while((len = net_recv(&ctx->net, &pkt, (struct NetSession**)&session, NULL))) {
 		const uint8_t *data = pkt, *end = &pkt[len];
 		struct NetPacketHeader header;
 		if(!pkt_read(&header, &data, end, PV_LEGACY_DEFAULT))
@@ -722,7 +800,7 @@ static void master_onWireLink(struct Context*, union WireLink *link) {
 }
 
 static pthread_t master_thread = NET_THREAD_INVALID;
-static struct Context ctx = {CLEAR_NETCONTEXT, NULL, NULL, NULL}; // TODO: This "singleton" can't actually scale up due to the pool API no longer being threadsafe
+static struct Context ctx = {CLEAR_NETCONTEXT, NULL, NULL, NULL, {0}}; // TODO: This "singleton" can't actually scale up due to the pool API no longer being threadsafe
 struct NetContext *master_init(const mbedtls_x509_crt *cert, const mbedtls_pk_context *key, uint16_t port) {
 	if(net_init(&ctx.net, port, false, 16)) {
 		uprintf("net_init() failed\n");
@@ -741,8 +819,9 @@ struct NetContext *master_init(const mbedtls_x509_crt *cert, const mbedtls_pk_co
 	}
 	ctx.cert = cert;
 	ctx.key = key;
+	mbedtls_ctr_drbg_random(net_get_ctr_drbg(&ctx.net), ctx.cookieSecret, sizeof(ctx.cookieSecret));
 	ctx.net.userptr = &ctx;
-	ctx.net.onResolve = (struct NetSession *(*)(void*, struct SS, const uint8_t*, uint32_t, uint8_t*, uint32_t*, void**))master_onResolve;
+	ctx.net.onResolve = (struct NetSession *(*)(void*, struct SS, uint8_t*, uint32_t, uint8_t**, uint32_t*, void**))master_onResolve;
 	ctx.net.onResend = (uint32_t (*)(void*, uint32_t))master_onResend;
 	ctx.net.onWireLink = (void (*)(void*, union WireLink*))master_onWireLink;
 	ctx.net.onWireMessage = (void (*)(void*, union WireLink*, const struct WireMessage*))master_onWireMessage;
@@ -1,4 +1,7 @@
 #define __STDC_WANT_LIB_EXT1__ 1
+#ifndef WINDOWS
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+#endif
 #include "global.h"
 #define NET_H_PRIVATE(x) x
 #include "net.h"
@@ -13,14 +16,46 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/udp.h>
+#include <linux/io_uring.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
 #define net_error() (errno)
 #endif
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #define ENCRYPTION_LAYER_SIZE 63
+#define NET_POLL_EVENTS 16
+#define NET_DRAIN_BUDGET 64 // datagrams to read before giving the other sockets a chance to be serviced
+#define NET_RECV_BUFFER_SIZE 1536
+#define NET_RECV_CONTROL_SIZE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))) // room for the SO_TIMESTAMPNS and SO_RXQ_OVFL of one datagram
+#define NET_GSO_MAX_SEGMENTS 64
+#define NET_GSO_MAX_BYTES 65507 // largest UDP payload over IPv4
+#define NET_GSO_REFUSED_MAX 8
+#define NET_GRO_BATCH 8 // merged datagrams read per call
+#define NET_MERGE_FLUSH_BATCH HMAC_LANES // held datagrams encrypted together when a receive batch ends
+#define NET_GRO_BUFFER_SIZE 65536
+#define NET_MTU_PROBE_ATTEMPTS 4 // unanswered probes before settling on the current MTU
+#define NET_BUFFER_TUNE_INTERVAL_MS 1000
+#define NET_BUFFER_TUNE_MAX (16u << 20) // largest receive buffer `net_autoTune` grows a socket to
+
+#ifdef SO_RCVBUFFORCE
+#define NET_SO_RCVBUFFORCE SO_RCVBUFFORCE
+#define NET_SO_SNDBUFFORCE SO_SNDBUFFORCE
+#else
+#define NET_SO_RCVBUFFORCE SO_RCVBUF
+#define NET_SO_SNDBUFFORCE SO_SNDBUF
+#endif
 
 static const uint16_t PossibleMtu[] = {
 	576 - ENCRYPTION_LAYER_SIZE - 68,
@@ -48,9 +83,6 @@ bool NetKeypair_write_key(const struct NetKeypair *keys, struct NetContext *ctx,
 	out->length = NetKeypair_write_key_internal(keys, ctx, out->data, sizeof(out->data));
 	return out->length == 0;
 }
-const struct Cookie32 *NetSession_get_cookie(const struct NetSession *session) {
-	return &session->cookie;
-}
 bool NetSession_signature(struct NetSession *session, struct NetContext *ctx, const mbedtls_pk_context *key, struct ByteArrayNetSerializable *out) {
 	out->length = 0;
 	if(mbedtls_pk_get_type(key) != MBEDTLS_PK_RSA) {
@@ -115,6 +147,9 @@ const struct SS *NetSession_get_addr(struct NetSession *session) {
 uint32_t NetSession_decrypt(struct NetSession *session, const uint8_t packet[static 1536], uint32_t packet_len, uint8_t out[static 1536]) {
 	return EncryptionState_decrypt(&session->encryptionState, packet, &packet[packet_len], out);
 }
+uint32_t NetSession_decrypt_inplace(struct NetSession *session, uint8_t *packet, uint32_t packet_len, uint8_t **out) {
+	return EncryptionState_decrypt_inplace(&session->encryptionState, packet, &packet[packet_len], out);
+}
 
 int32_t net_get_sockfd(struct NetContext *ctx) {
 	return ctx->sockfd;
@@ -165,6 +200,20 @@ bool SS_equal(const struct SS *addr0, const struct SS *addr1) {
 	return memcmp(&norm[0].sin6_addr, &norm[1].sin6_addr, sizeof(struct in6_addr)) == 0 && norm[0].sin6_port == norm[1].sin6_port;
 }
 
+struct NetAddrKey SS_key(const struct SS *addr) {
+	struct sockaddr_in6 norm = SS_to6(addr);
+	struct NetAddrKey key = {.port = norm.sin6_port};
+	memcpy(key.addr, &norm.sin6_addr, sizeof(key.addr));
+	return key;
+}
+
+uint32_t NetAddrKey_hash(const struct NetAddrKey *key) {
+	uint32_t hash = 2166136261u;
+	for(const uint8_t *it = (const uint8_t*)key, *end = &it[sizeof(*key)]; it < end; ++it)
+		hash = (hash ^ *it) * 16777619u;
+	return hash;
+}
+
 static struct Cookie32 net_cookie(mbedtls_ctr_drbg_context *ctr_drbg) {
 	struct Cookie32 out;
 	mbedtls_ctr_drbg_random(ctr_drbg, out.raw, sizeof(out.raw));
@@ -178,18 +227,322 @@ static struct timespec GetTime() {
 	return now;
 }
 
+static struct NetClock NetClock_at(struct timespec now) {
+	return (struct NetClock){
+		.mono = now,
+		.ms = (uint32_t)((uint64_t)now.tv_sec * UINT64_C(1000) + (uint64_t)now.tv_nsec / UINT64_C(1000000)),
+	};
+}
+
 uint32_t net_time() {
-	struct timespec now = GetTime();
-	return (uint32_t)((uint64_t)now.tv_sec * UINT64_C(1000) + (uint64_t)now.tv_nsec / UINT64_C(1000000));
+	return NetClock_at(GetTime()).ms;
+}
+
+#define NET_RATE_SOURCES 1024
+#define NET_PING_PER_SOURCE 4 // replies per second to any single address
+
+// Global token bucket refilled at `rate` per second (unlimited if 0), plus a budget of `perSource` per second for each address
+struct NetRateLimit {
+	uint32_t tokens, refilled;
+	struct NetRateSource {
+		uint32_t second, count;
+	} sources[NET_RATE_SOURCES]; // indexed by a hash of the address without its port
+};
+
+static void NetRateLimit_init(struct NetRateLimit *limit, uint32_t rate) {
+	limit->tokens = rate;
+	limit->refilled = net_time();
+	memset(limit->sources, 0, sizeof(limit->sources));
+}
+
+static bool NetRateLimit_accept(struct NetRateLimit *limit, uint32_t rate, uint32_t perSource, const struct SS *addr, uint32_t currentTime) {
+	if(rate) {
+		uint32_t refill = (uint32_t)((uint64_t)(currentTime - limit->refilled) * rate / 1000);
+		if(refill >= rate - limit->tokens) {
+			limit->tokens = rate;
+			limit->refilled = currentTime;
+		} else if(refill) {
+			limit->tokens += refill;
+			limit->refilled += (uint32_t)((uint64_t)refill * 1000 / rate);
+		}
+		if(!limit->tokens)
+			return false;
+	}
+	struct NetAddrKey key = SS_key(addr);
+	key.port = 0;
+	struct NetRateSource *source = &limit->sources[NetAddrKey_hash(&key) % NET_RATE_SOURCES];
+	if(source->second != currentTime / 1000)
+		*source = (struct NetRateSource){currentTime / 1000, 0};
+	if(source->count >= perSource)
+		return false;
+	++source->count;
+	limit->tokens -= (rate != 0);
+	return true;
+}
+
+// Rate limit and counters for answering pings; the limiter is only touched by the thread answering them
+struct NetPingResponder {
+	struct NetRateLimit limit; // refilled at `net_pingRate` per second
+	atomic_uint_least64_t answered, limited, stray;
+};
+
+static struct NetPingResponder *NetPingResponder_new() {
+	struct NetPingResponder *responder = malloc(sizeof(*responder));
+	if(!responder)
+		return NULL;
+	NetRateLimit_init(&responder->limit, net_pingRate);
+	atomic_init(&responder->answered, 0);
+	atomic_init(&responder->limited, 0);
+	atomic_init(&responder->stray, 0);
+	return responder;
+}
+
+// Returns `true` if a ping from `addr` should be answered
+static bool NetPingResponder_accept(struct NetPingResponder *responder, const struct SS *addr, uint32_t currentTime) {
+	if(!NetRateLimit_accept(&responder->limit, net_pingRate, NET_PING_PER_SOURCE, addr, currentTime)) {
+		atomic_fetch_add_explicit(&responder->limited, 1, memory_order_relaxed);
+		return false;
+	}
+	atomic_fetch_add_explicit(&responder->answered, 1, memory_order_relaxed);
+	return true;
+}
+
+static void NetPingResponder_collect(const struct NetPingResponder *responder, struct NetPingStats *out) {
+	out->answered += atomic_load_explicit(&responder->answered, memory_order_relaxed);
+	out->limited += atomic_load_explicit(&responder->limited, memory_order_relaxed);
+	out->stray += atomic_load_explicit(&responder->stray, memory_order_relaxed);
+}
+
+struct NetUring;
+struct NetSendQueue {
+	uint16_t count;
+	uint32_t since; // `ctx->clock.ms` at which the oldest queued datagram was added
+	#ifdef WINDOWS
+	uint32_t iov_len[NET_SEND_BATCH];
+	#else
+	struct NetUring *uring; // submits the flushed messages as SENDMSG requests instead of calling `sendmmsg()` if set
+	bool gso; // the kernel accepts UDP_SEGMENT on this socket
+	uint16_t refused_len;
+	struct NetAddrKey refused[NET_GSO_REFUSED_MAX]; // destinations whose route rejected a segmented send, not yet seen by their session
+	struct mmsghdr headers[NET_SEND_BATCH]; // one per slot
+	struct iovec iov[NET_SEND_BATCH];
+	struct mmsghdr batch[NET_SEND_BATCH]; // `headers` with same-destination runs merged, rebuilt on every flush
+	_Alignas(struct cmsghdr) uint8_t control[NET_SEND_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+	#endif
+	struct NetSendSlot {
+		struct SS addr;
+		bool gso; // may be merged with neighbouring datagrams to the same address
+		uint8_t data[NET_RECV_BUFFER_SIZE];
+	} slots[NET_SEND_BATCH];
+};
+
+static struct NetSendQueue *NetSendQueue_new() {
+	struct NetSendQueue *queue = malloc(sizeof(*queue));
+	if(!queue)
+		return NULL;
+	queue->count = 0;
+	queue->since = 0;
+	#ifndef WINDOWS
+	queue->uring = NULL;
+	queue->gso = false;
+	queue->refused_len = 0;
+	for(uint32_t i = 0; i < lengthof(queue->slots); ++i) {
+		queue->iov[i] = (struct iovec){queue->slots[i].data, 0};
+		queue->headers[i].msg_hdr = (struct msghdr){
+			.msg_name = &queue->slots[i].addr.ss,
+			.msg_iov = &queue->iov[i],
+			.msg_iovlen = 1,
+		};
+	}
+	#endif
+	return queue;
+}
+
+#ifndef WINDOWS
+// Merges runs of datagrams to the same destination into single UDP_SEGMENT sends. Every segment but the last must have the same size; the last may be shorter.
+static struct mmsghdr *NetSendQueue_coalesce(struct NetSendQueue *queue, uint32_t *msgs_len, struct NetSendStats *stats) {
+	if(!queue->gso) {
+		*msgs_len = queue->count;
+		return queue->headers;
+	}
+	uint32_t count = 0;
+	for(uint32_t i = 0, n; i < queue->count; i += n, ++count) {
+		size_t size = queue->iov[i].iov_len, total = size;
+		n = 1;
+		if(queue->slots[i].gso) {
+			for(; i + n < queue->count && n < NET_GSO_MAX_SEGMENTS; total += queue->iov[i + n++].iov_len) {
+				if(queue->iov[i + n - 1].iov_len != size || queue->iov[i + n].iov_len > size || total + queue->iov[i + n].iov_len > NET_GSO_MAX_BYTES)
+					break;
+				if(!queue->slots[i + n].gso || !SS_equal(&queue->slots[i].addr, &queue->slots[i + n].addr))
+					break;
+			}
+		}
+		struct msghdr *msg = &queue->batch[count].msg_hdr;
+		*msg = queue->headers[i].msg_hdr;
+		msg->msg_iovlen = n;
+		if(n < 2)
+			continue;
+		struct cmsghdr *cmsg = (struct cmsghdr*)queue->control[count];
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		memcpy(CMSG_DATA(cmsg), &(uint16_t){(uint16_t)size}, sizeof(uint16_t));
+		msg->msg_control = queue->control[count];
+		msg->msg_controllen = sizeof(queue->control[count]);
+		stats->segmented += n;
+	}
+	*msgs_len = count;
+	return queue->batch;
+}
+
+// Accounts for a message the kernel rejected. A segmented send refused with EIO (no checksum offload along the route) is retried as plain datagrams, and its destination stops being merged.
+static void net_send_rejected(struct NetContext *ctx, const struct mmsghdr *msg, int32_t err) {
+	struct NetSendQueue *queue = ctx->sendQueue;
+	uint32_t segments = (uint32_t)msg->msg_hdr.msg_iovlen;
+	if(err != EIO || segments < 2) {
+		ctx->sendStats.errors += segments; // drop the datagrams at fault, same as the unchecked `sendto()` this replaces
+		return;
+	}
+	uint32_t first = (uint32_t)(msg->msg_hdr.msg_iov - queue->iov);
+	for(uint32_t sent = 0; sent < segments;) {
+		int res = sendmmsg(ctx->sockfd, &queue->headers[first + sent], segments - sent, 0);
+		if(res > 0) {
+			sent += (uint32_t)res;
+		} else if(net_error() != EINTR) {
+			++ctx->sendStats.errors;
+			++sent;
+		}
+	}
+	++ctx->sendStats.gsoRefused;
+	if(queue->refused_len < lengthof(queue->refused))
+		queue->refused[queue->refused_len++] = SS_key(&queue->slots[first].addr);
+}
+
+static uint32_t NetUring_send(struct NetUring *uring, struct NetContext *ctx, struct mmsghdr *msgs, uint32_t msgs_len);
+#endif
+
+// Nanoseconds since the epoch, comparable with SO_TIMESTAMPNS
+static uint64_t net_realtime() {
+	struct timespec now;
+	if(clock_gettime(CLOCK_REALTIME, &now))
+		return 0;
+	return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+}
+
+static void net_count_delay(_Atomic uint64_t histogram[static NET_LATENCY_BUCKETS], uint64_t arrival) {
+	uint64_t now = net_realtime(), us = (now > arrival) ? (now - arrival) / 1000u : 0;
+	uint32_t bucket = us ? 63u - (uint32_t)__builtin_clzll(us) : 0;
+	if(bucket >= NET_LATENCY_BUCKETS)
+		bucket = NET_LATENCY_BUCKETS - 1;
+	atomic_store_explicit(&histogram[bucket], atomic_load_explicit(&histogram[bucket], memory_order_relaxed) + 1, memory_order_relaxed); // only the owning thread writes
+}
+
+// Submits all queued datagrams in order
+static void net_flush_sends(struct NetContext *ctx) {
+	struct NetSendQueue *queue = ctx->sendQueue;
+	if(!queue || !queue->count) {
+		ctx->pendingArrival = 0; // nothing was sent in reply
+		return;
+	}
+	#ifdef WINDOWS
+	for(uint32_t i = 0; i < queue->count; ++i)
+		if(sendto(ctx->sockfd, (char*)queue->slots[i].data, queue->iov_len[i], 0, &queue->slots[i].addr.sa, queue->slots[i].addr.len) < 0)
+			++ctx->sendStats.errors;
+	#else
+	uint32_t msgs_len = 0;
+	struct mmsghdr *msgs = NetSendQueue_coalesce(queue, &msgs_len, &ctx->sendStats);
+	uint32_t sent = queue->uring ? NetUring_send(queue->uring, ctx, msgs, msgs_len) : 0;
+	while(sent < msgs_len) {
+		int res = sendmmsg(ctx->sockfd, &msgs[sent], msgs_len - sent, 0);
+		if(res > 0) {
+			sent += (uint32_t)res;
+		} else if(net_error() != EINTR) {
+			net_send_rejected(ctx, &msgs[sent], net_error());
+			++sent;
+		}
+	}
+	#endif
+	++ctx->sendStats.flushes;
+	ctx->sendStats.datagrams += queue->count;
+	queue->count = 0;
+	if(ctx->pendingArrival) {
+		net_count_delay(ctx->sendDelay, ctx->pendingArrival);
+		ctx->pendingArrival = 0;
+	}
+}
+
+// Fills in the next send slot once its datagram has been written
+static void net_queue_commit(struct NetContext *ctx, const struct SS *addr, [[maybe_unused]] bool gso, uint32_t body_len) {
+	struct NetSendQueue *queue = ctx->sendQueue;
+	struct NetSendSlot *slot = &queue->slots[queue->count];
+	slot->addr = *addr;
+	#ifdef WINDOWS
+	queue->iov_len[queue->count] = body_len;
+	#else
+	slot->gso = gso;
+	queue->iov[queue->count].iov_len = body_len;
+	queue->headers[queue->count].msg_hdr.msg_namelen = slot->addr.len;
+	#endif
+	if(!queue->count++)
+		queue->since = ctx->clock.ms;
+}
+
+// `state` is NULL for unencrypted datagrams
+static void net_queue_send(struct NetContext *ctx, const struct SS *addr, struct EncryptionState *state, bool gso, const uint8_t *buf, uint32_t len) {
+	struct NetSendQueue *queue = ctx->sendQueue;
+	if(queue->count >= lengthof(queue->slots))
+		net_flush_sends(ctx);
+	net_queue_commit(ctx, addr, gso, EncryptionState_encrypt(state, &ctx->ivs, buf, len, queue->slots[queue->count].data));
+}
+
+// Picks up a GSO refusal recorded against the session's address since its last send
+static void net_check_refused([[maybe_unused]] struct NetContext *ctx, [[maybe_unused]] struct NetSession *session) {
+	#ifndef WINDOWS
+	struct NetSendQueue *queue = ctx->sendQueue;
+	if(!queue->refused_len || session->gsoRefused)
+		return;
+	struct NetAddrKey key = SS_key(&session->addr);
+	for(uint32_t i = 0; i < queue->refused_len; ++i) {
+		if(memcmp(&queue->refused[i], &key, sizeof(key)))
+			continue;
+		session->gsoRefused = true;
+		queue->refused[i] = queue->refused[--queue->refused_len];
+		break;
+	}
+	#endif
 }
 
 void net_send_internal(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint32_t len, bool encrypt) {
-	uint8_t body[1536];
-	uint32_t body_len = EncryptionState_encrypt(encrypt ? &session->encryptionState : NULL, &ctx->ctr_drbg, buf, len, body);
-	sendto(ctx->sockfd, (char*)body, body_len, 0, &session->addr.sa, session->addr.len);
+	net_check_refused(ctx, session);
+	net_queue_send(ctx, &session->addr, encrypt ? &session->encryptionState : NULL, !session->gsoRefused, buf, len);
+}
+
+// Queues the merged datagram of every session at once, so their MACs are hashed side by side
+static void net_send_merged(struct NetContext *ctx, struct NetSession *const sessions[], uint32_t count) {
+	struct NetSendQueue *queue = ctx->sendQueue;
+	if(queue->count + count > lengthof(queue->slots))
+		net_flush_sends(ctx);
+	struct EncryptionJob jobs[NET_MERGE_FLUSH_BATCH];
+	for(uint32_t i = 0; i < count; ++i) {
+		net_check_refused(ctx, sessions[i]);
+		jobs[i] = (struct EncryptionJob){
+			.state = &sessions[i]->encryptionState,
+			.buf = sessions[i]->mergeData,
+			.buf_len = (uint32_t)(sessions[i]->mergeData_end - sessions[i]->mergeData),
+			.out = queue->slots[queue->count + i].data,
+		};
+	}
+	EncryptionState_encrypt_many(jobs, count, &ctx->ivs);
+	for(uint32_t i = 0; i < count; ++i)
+		net_queue_commit(ctx, &sessions[i]->addr, !sessions[i]->gsoRefused, jobs[i].out_len);
+}
+
+// Replies to an address which has no session, such as during a stateless handshake
+void net_send_unconnected(struct NetContext *ctx, const struct SS *addr, const uint8_t *buf, uint32_t len) {
+	net_queue_send(ctx, addr, NULL, false, buf, len);
 }
 
-static struct NetSession *onResolve_stub(void*, struct SS, const uint8_t*, uint32_t, uint8_t*, uint32_t*, void**) {return NULL;}
+static struct NetSession *onResolve_stub(void*, struct SS, uint8_t*, uint32_t, uint8_t**, uint32_t*, void**) {return NULL;}
 static uint32_t onResend_stub(void*, uint32_t) {return 180000;}
 static void onWireMessage_stub(void*, union WireLink*, const struct WireMessage*) {}
 
@@ -202,6 +555,10 @@ static const char *net_strerror(int32_t err) {
 	strerror_s(message, lengthof(message), err);
 	#elif (_POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600) && !defined(_GNU_SOURCE)
 	strerror_r(err, message, lengthof(message));
+	#elif defined(_GNU_SOURCE)
+	const char *str = strerror_r(err, message, lengthof(message)); // GNU variant may return a static string instead
+	if(str != message)
+		snprintf(message, lengthof(message), "%s", str);
 	#else
 	#error No strerror_s implementation available
 	#endif
@@ -211,7 +568,588 @@ static const char *net_strerror(int32_t err) {
 }
 
 bool net_useIPv4 = 0;
-static int32_t net_bind_udp(uint16_t port) {
+bool net_useUring = 0;
+bool net_useGro = 0;
+uint16_t net_recvBatch = NET_RECV_BATCH_DEFAULT;
+bool net_usePinger = 0;
+uint16_t net_pingRate = NET_PING_RATE_DEFAULT;
+uint32_t net_recvBuffer = 0;
+uint32_t net_sendBuffer = 0;
+bool net_autoTune = 0;
+
+typedef uint8_t NetOrigin;
+enum NetOrigin {
+	NetOrigin_Socket,
+	NetOrigin_Handoff, // forwarded by the shard which received it, since this shard owns the session
+	NetOrigin_Probe, // forwarded to shards which may own its session, since none is known for the address yet
+};
+
+struct NetRecvSlot {
+	struct SS addr;
+	uint32_t len;
+	uint8_t *data;
+	NetOrigin origin;
+	uint64_t arrival; // kernel receive time in nanoseconds since the epoch (SO_TIMESTAMPNS), or 0 if unknown
+};
+
+struct NetRecvRing {
+	uint16_t head, count, capacity;
+	#ifndef WINDOWS
+	struct NetUring *uring; // fills `slots` from a multishot receive instead of calling `recvmmsg()` if set
+	struct NetGro *gro; // fills `slots` by splitting datagrams merged by UDP_GRO if set
+	struct mmsghdr *headers; // parallel to `slots`, handed to `recvmmsg()` on every refill
+	struct iovec *iov;
+	uint8_t (*control)[NET_RECV_CONTROL_SIZE];
+	#endif
+	uint8_t (*buffers)[NET_RECV_BUFFER_SIZE];
+	uint32_t drops; // latest SO_RXQ_OVFL counter; the kernel reports the socket's running total
+	struct NetRecvSlot slots[];
+};
+
+#ifndef WINDOWS
+#define NET_URING_RECV 1 // `user_data` of the multishot receive
+#define NET_URING_CANCEL 2 // `user_data` of the cancellation ending the trial receive in `NetUring_new()`
+#define NET_URING_BGID 0
+#define NET_URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + NET_RECV_CONTROL_SIZE + NET_RECV_BUFFER_SIZE)
+
+// Returns the kernel receive time carried by SO_TIMESTAMPNS in nanoseconds since the epoch, or 0 if absent. Updates `*drops` if the datagram carries an SO_RXQ_OVFL counter.
+static uint64_t net_cmsg_parse(struct msghdr *msg, uint32_t *drops) {
+	uint64_t arrival = 0;
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if(cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+		if(cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec stamp;
+			memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+			arrival = (uint64_t)stamp.tv_sec * UINT64_C(1000000000) + (uint64_t)stamp.tv_nsec;
+		} else if(cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+		}
+	}
+	return arrival;
+}
+
+// Minimal io_uring instance, driven through the raw syscalls
+struct NetUring {
+	int32_t fd;
+	uint32_t sqEntries, sqMask, cqMask;
+	uint32_t *sqHead, *sqTail, *cqHead, *cqTail; // shared with the kernel; accessed through `__atomic` builtins
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqRing, *cqRing;
+	size_t sqRing_size, cqRing_size, sqes_size;
+	bool armed; // the multishot receive is still delivering completions
+	bool rejected; // the kernel failed the multishot receive itself; rearming would fail the same way
+	struct msghdr recvHdr;
+	struct io_uring_buf_ring *bufRing; // buffers provided for receiving, indexed by buffer ID
+	size_t bufRing_size;
+	uint8_t *buffers;
+	uint16_t bufMask, bufTail;
+	uint16_t held_len;
+	uint16_t held[]; // buffers lent to the current batch of `NetRecvRing`, given back on the next fill
+};
+
+static int32_t net_uring_enter(int32_t fd, uint32_t submit, uint32_t wait) {
+	return (int32_t)syscall(__NR_io_uring_enter, fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void NetUring_free(struct NetUring *uring) {
+	if(!uring)
+		return;
+	if(uring->fd != -1)
+		close(uring->fd); // any multishot receive was already cancelled when the thread which armed it exited
+	if(uring->sqes)
+		munmap(uring->sqes, uring->sqes_size);
+	if(uring->cqRing && uring->cqRing != uring->sqRing)
+		munmap(uring->cqRing, uring->cqRing_size);
+	if(uring->sqRing)
+		munmap(uring->sqRing, uring->sqRing_size);
+	if(uring->bufRing)
+		munmap(uring->bufRing, uring->bufRing_size);
+	free(uring->buffers);
+	free(uring);
+}
+
+static void *net_uring_mmap(int32_t fd, size_t size, off_t offset) {
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+	return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+static void NetUring_provide(struct NetUring *uring, uint16_t bid) {
+	struct io_uring_buf *buf = &uring->bufRing->bufs[uring->bufTail++ & uring->bufMask];
+	buf->addr = (uintptr_t)&uring->buffers[bid * NET_URING_BUFFER_SIZE]; // `resv` overlaps the ring's tail and must not be written
+	buf->len = NET_URING_BUFFER_SIZE;
+	buf->bid = bid;
+}
+
+static bool NetUring_push(struct NetUring *uring, const struct io_uring_sqe *sqe) {
+	uint32_t tail = *uring->sqTail;
+	if(tail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE) >= uring->sqEntries)
+		return false;
+	uring->sqes[tail & uring->sqMask] = *sqe;
+	__atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// Submits everything pushed so far, waiting for at least `wait` completions. Returns -1 with `net_error()` set on failure.
+static int32_t NetUring_submit(struct NetUring *uring, uint32_t wait) {
+	int32_t res;
+	do {
+		res = net_uring_enter(uring->fd, *uring->sqTail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE), wait);
+	} while(res == -1 && net_error() == EINTR);
+	return res;
+}
+
+// Must be called from the thread serving the socket, since completions are delivered through its task work
+static bool NetUring_arm_recv(struct NetUring *uring, int32_t sockfd) {
+	if(!NetUring_push(uring, &(struct io_uring_sqe){
+		.opcode = IORING_OP_RECVMSG,
+		.flags = IOSQE_BUFFER_SELECT,
+		.ioprio = IORING_RECV_MULTISHOT,
+		.fd = sockfd,
+		.addr = (uintptr_t)&uring->recvHdr,
+		.len = 1,
+		.buf_group = NET_URING_BGID,
+		.user_data = NET_URING_RECV,
+	}))
+		return false;
+	uring->armed = (NetUring_submit(uring, 0) != -1);
+	return uring->armed;
+}
+
+// Returns true if the kernel implements `opcode`
+static bool NetUring_supports(const struct NetUring *uring, uint8_t opcode) {
+	struct io_uring_probe *probe = calloc(1, sizeof(*probe) + 256 * sizeof(*probe->ops));
+	if(!probe)
+		return false;
+	bool supported = !syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE, probe, 256) &&
+		opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return supported;
+}
+
+// Arms a multishot receive on a throwaway socket and cancels it again, since kernels before 6.0 know RECVMSG but fail the request once armed
+static bool NetUring_trial_recv(struct NetUring *uring) {
+	int32_t pair[2];
+	if(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, pair))
+		return false;
+	bool supported = NetUring_arm_recv(uring, pair[0]) && NetUring_push(uring, &(struct io_uring_sqe){
+		.opcode = IORING_OP_ASYNC_CANCEL,
+		.addr = NET_URING_RECV,
+		.user_data = NET_URING_CANCEL,
+	}) && NetUring_submit(uring, 2) != -1; // the receive completes either way: failed outright or cancelled
+	uint32_t head = *uring->cqHead, tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+	for(; head != tail; ++head) {
+		const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+		if(cqe->user_data == NET_URING_RECV && cqe->res != -ECANCELED)
+			supported = false;
+	}
+	__atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+	uring->armed = false;
+	close(pair[0]);
+	close(pair[1]);
+	if(!supported)
+		errno = EOPNOTSUPP;
+	return supported;
+}
+
+// Creates a ring with `entries` submission slots. If `buffers` is nonzero, that many receive buffers are registered as well. Returns NULL with `net_error()` set on failure.
+static struct NetUring *NetUring_new(uint32_t entries, uint16_t buffers) {
+	struct NetUring *uring = calloc(1, sizeof(*uring) + buffers * sizeof(*uring->held));
+	if(!uring)
+		return NULL;
+	struct io_uring_params params = {
+		.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP,
+		.cq_entries = 2 * (buffers > entries ? buffers : entries),
+	};
+	uring->fd = (int32_t)syscall(__NR_io_uring_setup, entries, &params);
+	if(uring->fd == -1)
+		goto fail;
+	uring->sqRing_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	uring->cqRing_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(uring->cqRing_size > uring->sqRing_size)
+			uring->sqRing_size = uring->cqRing_size;
+		uring->sqRing = net_uring_mmap(uring->fd, uring->sqRing_size, IORING_OFF_SQ_RING);
+		uring->cqRing = uring->sqRing;
+	} else {
+		uring->sqRing = net_uring_mmap(uring->fd, uring->sqRing_size, IORING_OFF_SQ_RING);
+		uring->cqRing = net_uring_mmap(uring->fd, uring->cqRing_size, IORING_OFF_CQ_RING);
+	}
+	uring->sqes = net_uring_mmap(uring->fd, uring->sqes_size, IORING_OFF_SQES);
+	if(!uring->sqRing || !uring->cqRing || !uring->sqes)
+		goto fail;
+	uring->sqEntries = params.sq_entries;
+	uring->sqMask = *(uint32_t*)((uint8_t*)uring->sqRing + params.sq_off.ring_mask);
+	uring->sqHead = (uint32_t*)((uint8_t*)uring->sqRing + params.sq_off.head);
+	uring->sqTail = (uint32_t*)((uint8_t*)uring->sqRing + params.sq_off.tail);
+	uring->cqMask = *(uint32_t*)((uint8_t*)uring->cqRing + params.cq_off.ring_mask);
+	uring->cqHead = (uint32_t*)((uint8_t*)uring->cqRing + params.cq_off.head);
+	uring->cqTail = (uint32_t*)((uint8_t*)uring->cqRing + params.cq_off.tail);
+	uring->cqes = (struct io_uring_cqe*)((uint8_t*)uring->cqRing + params.cq_off.cqes);
+	uint32_t *array = (uint32_t*)((uint8_t*)uring->sqRing + params.sq_off.array);
+	for(uint32_t i = 0; i < params.sq_entries; ++i) // SQEs are always consumed in ring order
+		array[i] = i;
+	if(!NetUring_supports(uring, buffers ? IORING_OP_RECVMSG : IORING_OP_SENDMSG)) {
+		errno = EOPNOTSUPP;
+		goto fail;
+	}
+	if(!buffers)
+		return uring;
+	uring->recvHdr = (struct msghdr){
+		.msg_namelen = sizeof(struct sockaddr_storage),
+		.msg_controllen = NET_RECV_CONTROL_SIZE,
+	};
+	uring->bufRing_size = buffers * sizeof(struct io_uring_buf);
+	uring->bufRing = mmap(NULL, uring->bufRing_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); // must be page aligned
+	if(uring->bufRing == MAP_FAILED) {
+		uring->bufRing = NULL;
+		goto fail;
+	}
+	uring->buffers = malloc(buffers * NET_URING_BUFFER_SIZE);
+	if(!uring->buffers)
+		goto fail;
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uintptr_t)uring->bufRing,
+		.ring_entries = buffers,
+		.bgid = NET_URING_BGID,
+	};
+	if(syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+		goto fail;
+	uring->bufMask = (uint16_t)(buffers - 1);
+	for(uint16_t i = 0; i < buffers; ++i)
+		NetUring_provide(uring, i);
+	__atomic_store_n(&uring->bufRing->tail, uring->bufTail, __ATOMIC_RELEASE);
+	if(!NetUring_trial_recv(uring))
+		goto fail;
+	return uring;
+	fail:;
+	int err = net_error();
+	NetUring_free(uring);
+	errno = err;
+	return NULL;
+}
+
+// Collects up to `ring->capacity` completed receives. Returns -1 with `net_error()` set if nothing was read, which is EOPNOTSUPP once the kernel has rejected the receive for good.
+static int32_t NetUring_fill(struct NetUring *uring, struct NetRecvRing *ring, int32_t sockfd) {
+	for(uint16_t i = 0; i < uring->held_len; ++i)
+		NetUring_provide(uring, uring->held[i]);
+	if(uring->held_len)
+		__atomic_store_n(&uring->bufRing->tail, uring->bufTail, __ATOMIC_RELEASE);
+	uring->held_len = 0;
+	ring->head = 0;
+	ring->count = 0;
+	uint32_t head = *uring->cqHead, tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+	for(; head != tail && ring->count < ring->capacity; ++head) {
+		const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+		if(!(cqe->flags & IORING_CQE_F_MORE))
+			uring->armed = false;
+		if(cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+			if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+				uring->rejected = true;
+			else if(cqe->res < 0 && cqe->res != -ENOBUFS) // running out of buffers only ends the multishot; it is rearmed below
+				uprintf("io_uring recvmsg failed: %s\n", net_strerror(-cqe->res));
+			continue;
+		}
+		uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		uint8_t *buf = &uring->buffers[bid * NET_URING_BUFFER_SIZE];
+		const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out*)buf;
+		struct NetRecvSlot *slot = &ring->slots[ring->count++];
+		uring->held[uring->held_len++] = bid;
+		slot->addr.len = (out->namelen < sizeof(struct sockaddr_storage)) ? out->namelen : sizeof(struct sockaddr_storage);
+		memcpy(&slot->addr.ss, &buf[sizeof(*out)], slot->addr.len);
+		slot->arrival = net_cmsg_parse(&(struct msghdr){ // the kernel lays out the name, then the control data, then the payload
+			.msg_control = &buf[sizeof(*out) + sizeof(struct sockaddr_storage)],
+			.msg_controllen = (out->controllen < NET_RECV_CONTROL_SIZE) ? out->controllen : NET_RECV_CONTROL_SIZE,
+		}, &ring->drops);
+		slot->data = &buf[sizeof(*out) + sizeof(struct sockaddr_storage) + NET_RECV_CONTROL_SIZE];
+		slot->len = (out->payloadlen < NET_RECV_BUFFER_SIZE) ? out->payloadlen : NET_RECV_BUFFER_SIZE;
+	}
+	__atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+	if(uring->rejected) { // hand out what arrived before, then let the caller switch to `recvmmsg()`
+		if(ring->count)
+			return ring->count;
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if(!uring->armed && !NetUring_arm_recv(uring, sockfd))
+		return -1;
+	if(!ring->count) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return ring->count;
+}
+
+// Issues one SENDMSG per message and waits for all of them, since their buffers are reused by the next pass. Returns the number of messages handled, which is less than `msgs_len` only if the ring failed.
+static uint32_t NetUring_send(struct NetUring *uring, struct NetContext *ctx, struct mmsghdr *msgs, uint32_t msgs_len) {
+	uint32_t queued = 0, done = 0;
+	while(done < msgs_len) {
+		for(; queued < msgs_len; ++queued) {
+			if(!NetUring_push(uring, &(struct io_uring_sqe){
+				.opcode = IORING_OP_SENDMSG,
+				.fd = ctx->sockfd,
+				.addr = (uintptr_t)&msgs[queued].msg_hdr,
+				.len = 1,
+				.user_data = queued,
+			}))
+				break;
+		}
+		if(NetUring_submit(uring, queued - done) == -1 && net_error() != EBUSY && net_error() != EAGAIN) {
+			uprintf("io_uring_enter() failed: %s\n", net_strerror(net_error()));
+			queued -= *uring->sqTail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE); // take back anything the kernel didn't consume
+			*uring->sqTail = *uring->sqHead;
+			if(queued == done)
+				break;
+		}
+		uint32_t head = *uring->cqHead, tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+		for(; head != tail; ++head, ++done) {
+			const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+			if(cqe->res < 0)
+				net_send_rejected(ctx, &msgs[cqe->user_data], -cqe->res);
+		}
+		__atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+	}
+	return done;
+}
+
+// Switches the context to io_uring for both directions, or leaves it on `recvmmsg()` and `sendmmsg()` if the kernel refuses
+static void net_init_uring(struct NetContext *ctx) {
+	uint16_t buffers = 64;
+	while(buffers < 4 * ctx->recvRing->capacity)
+		buffers *= 2;
+	ctx->recvRing->uring = NetUring_new(buffers, buffers);
+	if(ctx->recvRing->uring)
+		ctx->sendQueue->uring = NetUring_new(NET_SEND_BATCH, 0);
+	if(!ctx->recvRing->uring || !ctx->sendQueue->uring) {
+		uprintf("io_uring unavailable (%s); falling back to recvmmsg()/sendmmsg()\n", net_strerror(net_error()));
+		NetUring_free(ctx->recvRing->uring);
+		ctx->recvRing->uring = NULL;
+		return;
+	}
+	ctx->sockReady = true; // the multishot receive is armed by the first fill, on the thread serving this context
+}
+#endif
+
+static void NetRecvRing_free(struct NetRecvRing *ring) {
+	if(!ring)
+		return;
+	#ifndef WINDOWS
+	NetUring_free(ring->uring);
+	free(ring->gro);
+	free(ring->headers);
+	free(ring->iov);
+	free(ring->control);
+	#endif
+	free(ring->buffers);
+	free(ring);
+}
+
+static struct NetRecvRing *NetRecvRing_new(uint16_t capacity) {
+	#ifdef WINDOWS
+	capacity = 1; // no batched receive available
+	#endif
+	struct NetRecvRing *ring = malloc(sizeof(*ring) + capacity * sizeof(*ring->slots));
+	if(!ring)
+		return NULL;
+	*ring = (struct NetRecvRing){
+		.head = 0,
+		.count = 0,
+		.capacity = capacity,
+		#ifndef WINDOWS
+		.uring = NULL,
+		.gro = NULL,
+		.headers = calloc(capacity, sizeof(*ring->headers)),
+		.iov = calloc(capacity, sizeof(*ring->iov)),
+		.control = calloc(capacity, sizeof(*ring->control)),
+		#endif
+		.buffers = malloc(capacity * sizeof(*ring->buffers)),
+		.drops = 0,
+	};
+	bool failed = !ring->buffers;
+	#ifndef WINDOWS
+	failed |= !ring->headers || !ring->iov || !ring->control;
+	#endif
+	if(failed) {
+		NetRecvRing_free(ring);
+		return NULL;
+	}
+	for(uint16_t i = 0; i < capacity; ++i) {
+		ring->slots[i].data = ring->buffers[i];
+		ring->slots[i].origin = NetOrigin_Socket;
+		ring->slots[i].arrival = 0;
+		#ifndef WINDOWS
+		ring->iov[i] = (struct iovec){ring->slots[i].data, NET_RECV_BUFFER_SIZE};
+		ring->headers[i].msg_hdr = (struct msghdr){
+			.msg_name = &ring->slots[i].addr.ss,
+			.msg_namelen = sizeof(struct sockaddr_storage),
+			.msg_iov = &ring->iov[i],
+			.msg_iovlen = 1,
+			.msg_control = ring->control[i],
+			.msg_controllen = sizeof(ring->control[i]),
+		};
+		#endif
+	}
+	return ring;
+}
+
+#ifndef WINDOWS
+struct NetGro {
+	uint16_t received, next; // merged datagrams from the last read, and the one being split
+	uint32_t offset; // of the next segment in `buffers[next]`
+	uint32_t segmentSize[NET_GRO_BATCH];
+	struct mmsghdr headers[NET_GRO_BATCH];
+	struct iovec iov[NET_GRO_BATCH];
+	struct SS addr[NET_GRO_BATCH];
+	uint64_t arrival[NET_GRO_BATCH];
+	_Alignas(struct cmsghdr) uint8_t control[NET_GRO_BATCH][CMSG_SPACE(sizeof(int)) + NET_RECV_CONTROL_SIZE];
+	uint8_t buffers[NET_GRO_BATCH][NET_GRO_BUFFER_SIZE + NET_RECV_BUFFER_SIZE]; // padded so every segment is followed by a full receive buffer
+};
+
+static struct NetGro *NetGro_new() {
+	struct NetGro *gro = malloc(sizeof(*gro));
+	if(!gro)
+		return NULL;
+	gro->received = 0;
+	gro->next = 0;
+	gro->offset = 0;
+	for(uint32_t i = 0; i < NET_GRO_BATCH; ++i) {
+		gro->iov[i] = (struct iovec){gro->buffers[i], NET_GRO_BUFFER_SIZE};
+		gro->headers[i].msg_hdr = (struct msghdr){
+			.msg_name = &gro->addr[i].ss,
+			.msg_iov = &gro->iov[i],
+			.msg_iovlen = 1,
+			.msg_control = gro->control[i],
+		};
+	}
+	return gro;
+}
+
+// Splits merged datagrams into `ring->slots`, reading more only once every segment of the previous read was handed out. Returns -1 with `net_error()` set if nothing was read.
+static int32_t NetGro_fill(struct NetGro *gro, struct NetRecvRing *ring, int32_t sockfd, struct NetRecvStats *stats) {
+	ring->head = 0;
+	ring->count = 0;
+	if(gro->next == gro->received) {
+		for(uint32_t i = 0; i < NET_GRO_BATCH; ++i) {
+			gro->headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+			gro->headers[i].msg_hdr.msg_controllen = sizeof(gro->control[i]);
+		}
+		gro->received = 0;
+		gro->next = 0;
+		gro->offset = 0;
+		int count = recvmmsg(sockfd, gro->headers, NET_GRO_BATCH, MSG_DONTWAIT, NULL);
+		if(count < 0)
+			return -1;
+		for(uint16_t i = 0; i < (uint16_t)count; ++i) {
+			struct msghdr *msg = &gro->headers[i].msg_hdr;
+			gro->addr[i].len = msg->msg_namelen;
+			gro->segmentSize[i] = gro->headers[i].msg_len;
+			gro->arrival[i] = net_cmsg_parse(msg, &ring->drops);
+			for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+				if(cmsg->cmsg_level != SOL_UDP || cmsg->cmsg_type != UDP_GRO)
+					continue;
+				int size;
+				memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+				if(size > 0 && (uint32_t)size < gro->segmentSize[i]) {
+					gro->segmentSize[i] = (uint32_t)size;
+					stats->merged += (gro->headers[i].msg_len + (uint32_t)size - 1) / (uint32_t)size;
+				}
+			}
+		}
+		gro->received = (uint16_t)count;
+	}
+	while(gro->next < gro->received && ring->count < ring->capacity) {
+		uint32_t len = gro->headers[gro->next].msg_len, size = gro->segmentSize[gro->next];
+		struct NetRecvSlot *slot = &ring->slots[ring->count++];
+		slot->addr = gro->addr[gro->next];
+		slot->arrival = gro->arrival[gro->next];
+		slot->data = &gro->buffers[gro->next][gro->offset];
+		slot->len = (len - gro->offset < size) ? len - gro->offset : size;
+		gro->offset += size;
+		if(gro->offset >= len) {
+			++gro->next;
+			gro->offset = 0;
+		}
+	}
+	return ring->count;
+}
+
+// Lets the kernel deliver runs of datagrams from one sender as a single merged read, or leaves the socket unchanged if unsupported
+static void net_init_gro(struct NetContext *ctx) {
+	if(setsockopt(ctx->sockfd, SOL_UDP, UDP_GRO, &(int){1}, sizeof(int))) {
+		uprintf("UDP_GRO unavailable (%s); receiving unmerged datagrams\n", net_strerror(net_error()));
+		return;
+	}
+	ctx->recvRing->gro = NetGro_new();
+	if(!ctx->recvRing->gro) {
+		uprintf("alloc error\n");
+		setsockopt(ctx->sockfd, SOL_UDP, UDP_GRO, &(int){0}, sizeof(int)); // merged reads would be truncated by the regular buffers
+	}
+}
+#endif
+
+// Reads up to `ring->capacity` datagrams in a single call. Returns -1 with `net_error()` set if nothing was read.
+static int32_t NetRecvRing_fill(struct NetRecvRing *ring, int32_t sockfd, [[maybe_unused]] struct NetRecvStats *stats) {
+	#ifdef WINDOWS
+	ring->head = 0;
+	ring->count = 0;
+	struct NetRecvSlot *slot = &ring->slots[0];
+	slot->addr.len = sizeof(struct sockaddr_storage);
+	int raw_len = recvfrom(sockfd, (char*)slot->data, NET_RECV_BUFFER_SIZE, 0, &slot->addr.sa, &slot->addr.len);
+	if(raw_len < 0)
+		return -1;
+	slot->len = (uint32_t)raw_len;
+	ring->count = 1;
+	#else
+	if(ring->uring) {
+		int32_t count = NetUring_fill(ring->uring, ring, sockfd);
+		if(count != -1 || net_error() != EOPNOTSUPP)
+			return count;
+		uprintf("io_uring multishot receive rejected; falling back to recvmmsg()\n");
+		NetUring_free(ring->uring); // closing the ring also drops it from the epoll set
+		ring->uring = NULL;
+		for(uint16_t i = 0; i < ring->capacity; ++i)
+			ring->slots[i].data = ring->buffers[i];
+	}
+	if(ring->gro)
+		return NetGro_fill(ring->gro, ring, sockfd, stats);
+	for(uint16_t i = 0; i < ring->count; ++i) { // only the headers of received datagrams are written back by the kernel
+		ring->headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		ring->headers[i].msg_hdr.msg_controllen = sizeof(ring->control[i]);
+	}
+	ring->head = 0;
+	ring->count = 0;
+	int count = recvmmsg(sockfd, ring->headers, ring->capacity, MSG_DONTWAIT, NULL); // non-blocking reads only, so sends keep their blocking semantics
+	if(count < 0)
+		return -1;
+	for(uint16_t i = 0; i < (uint16_t)count; ++i) {
+		ring->slots[i].addr.len = ring->headers[i].msg_hdr.msg_namelen;
+		ring->slots[i].len = ring->headers[i].msg_len;
+		ring->slots[i].arrival = net_cmsg_parse(&ring->headers[i].msg_hdr, &ring->drops);
+	}
+	ring->count = (uint16_t)count;
+	#endif
+	return ring->count;
+}
+
+static uint32_t net_get_buffer(int32_t sockfd, int32_t option) {
+	int32_t size = 0;
+	if(getsockopt(sockfd, SOL_SOCKET, option, (char*)&size, &(socklen_t){sizeof(size)}) || size < 0)
+		return 0;
+	return (uint32_t)size;
+}
+
+// Requests a socket buffer size, going past `net.core.[rw]mem_max` where permitted. Returns the size the kernel settled on.
+static uint32_t net_set_buffer(int32_t sockfd, int32_t option, int32_t forceOption, uint32_t size) {
+	int32_t value = (size > INT32_MAX) ? INT32_MAX : (int32_t)size;
+	if(forceOption == option || setsockopt(sockfd, SOL_SOCKET, forceOption, (char*)&value, sizeof(value))) // the forced variant requires CAP_NET_ADMIN
+		if(setsockopt(sockfd, SOL_SOCKET, option, (char*)&value, sizeof(value)))
+			uprintf("Failed to set socket buffer size to %u: %s\n", size, net_strerror(net_error()));
+	return net_get_buffer(sockfd, option);
+}
+
+static int32_t net_bind_udp(uint16_t port, bool reusePort) {
 	#ifdef WINDOWS
 	int err = WSAStartup(MAKEWORD(2,0), &(WSADATA){0});
 	if(err) {
@@ -227,6 +1165,35 @@ static int32_t net_bind_udp(uint16_t port) {
 		#endif
 		return -1;
 	}
+	#ifdef SO_REUSEPORT
+	if(reusePort && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (char*)(int32_t[]){1}, sizeof(int32_t))) {
+		uprintf("Failed to enable SO_REUSEPORT: %s\n", net_strerror(net_error()));
+		net_close(sockfd);
+		return -1;
+	}
+	#else
+	if(reusePort) {
+		uprintf("SO_REUSEPORT not supported on this platform\n");
+		net_close(sockfd);
+		return -1;
+	}
+	#endif
+	// Oversized MtuCheck probes must be dropped along the path rather than fragmented, and the kernel's cached path MTU must not get in the way of `net_probe_mtu()`
+	#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+	setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &(int){IP_PMTUDISC_PROBE}, sizeof(int));
+	if(!net_useIPv4)
+		setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &(int){IPV6_PMTUDISC_PROBE}, sizeof(int));
+	#elif defined(IP_DONTFRAGMENT)
+	setsockopt(sockfd, IPPROTO_IP, IP_DONTFRAGMENT, (char*)(int32_t[]){1}, sizeof(int32_t));
+	#endif
+	if(net_recvBuffer)
+		net_set_buffer(sockfd, SO_RCVBUF, NET_SO_RCVBUFFORCE, net_recvBuffer);
+	if(net_sendBuffer)
+		net_set_buffer(sockfd, SO_SNDBUF, NET_SO_SNDBUFFORCE, net_sendBuffer);
+	#ifdef SO_RXQ_OVFL
+	if(setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &(int){1}, sizeof(int))) // drop counts for `struct NetSocketStats`
+		uprintf("SO_RXQ_OVFL unavailable: %s\n", net_strerror(net_error()));
+	#endif
 	struct SS addr;
 	if(net_useIPv4) {
 		addr.len = sizeof(struct sockaddr_in);
@@ -302,42 +1269,913 @@ void net_close(int32_t sockfd) {
 	#endif
 }
 
-bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, uint32_t tcpBacklog) {
-	*ctx = (struct NetContext){
-		._typeid = WireLinkType_LOCAL,
-		.sockfd = net_bind_udp(port),
-		.listenfd = tcpBacklog ? net_bind_tcp(port, tcpBacklog) : -1,
-		.run = false,
-		.filterUnencrypted = filterUnencrypted,
-		.mutex = PTHREAD_MUTEX_INITIALIZER,
-		// .ctr_drbg = {},
-		// .entropy = {},
-		// .grp = {},
-		.remoteLinks_len = 0,
-		.cookies_len = 0,
-		.remoteLinks = {NULL},
-		.cookies = NULL,
-		.userptr = NULL,
-		.onResolve = onResolve_stub,
-		.onResend = onResend_stub,
-		.onWireLink = NULL,
-		.onWireMessage = onWireMessage_stub,
-		.perf = perf_init(),
-	};
+#ifndef WINDOWS
+#define NET_PING_BATCH 32
+
+// Answers pings on its own SO_REUSEPORT socket and thread, so they never wait on a context's owning thread or compete with its game traffic
+struct NetPinger {
+	int32_t sockfd;
+	atomic_bool run;
+	pthread_t thread;
+	struct NetPingResponder *responder;
+};
+
+static void *NetPinger_run(struct NetPinger *pinger) {
+	struct SS addrs[NET_PING_BATCH];
+	uint8_t data[NET_PING_BATCH]; // only the first byte of a ping is echoed
+	struct iovec iov[NET_PING_BATCH];
+	struct mmsghdr msgs[NET_PING_BATCH], replies[NET_PING_BATCH];
+	for(uint32_t i = 0; i < NET_PING_BATCH; ++i)
+		iov[i] = (struct iovec){.iov_base = &data[i], .iov_len = 1};
+	while(atomic_load(&pinger->run)) {
+		for(uint32_t i = 0; i < NET_PING_BATCH; ++i) {
+			msgs[i].msg_hdr = (struct msghdr){
+				.msg_name = &addrs[i].ss,
+				.msg_namelen = sizeof(addrs[i].ss),
+				.msg_iov = &iov[i],
+				.msg_iovlen = 1,
+			};
+		}
+		int count = recvmmsg(pinger->sockfd, msgs, NET_PING_BATCH, MSG_WAITFORONE, NULL);
+		if(!atomic_load(&pinger->run))
+			break;
+		if(count < 0) {
+			if(net_error() == EINTR)
+				continue;
+			uprintf("Ping socket failed: %s\n", net_strerror(net_error()));
+			break;
+		}
+		uint32_t currentTime = net_time(), replies_len = 0;
+		for(uint32_t i = 0; i < (uint32_t)count; ++i) {
+			if(!msgs[i].msg_len || data[i] <= 1) {
+				atomic_fetch_add_explicit(&pinger->responder->stray, 1, memory_order_relaxed);
+				continue;
+			}
+			addrs[i].len = msgs[i].msg_hdr.msg_namelen;
+			if(NetPingResponder_accept(pinger->responder, &addrs[i], currentTime))
+				replies[replies_len++].msg_hdr = msgs[i].msg_hdr;
+		}
+		for(uint32_t sent = 0; sent < replies_len;) {
+			int res = sendmmsg(pinger->sockfd, &replies[sent], replies_len - sent, 0);
+			if(res <= 0) {
+				if(res < 0 && net_error() == EINTR)
+					continue;
+				break; // best effort, like any other datagram
+			}
+			sent += (uint32_t)res;
+		}
+	}
+	return NULL;
+}
+
+// Binds another socket to the port of `sockfd`; the caller must steer pings to it before calling `NetPinger_start()`
+static struct NetPinger *NetPinger_new(int32_t sockfd) {
+	struct SS addr = {.len = sizeof(struct sockaddr_storage)};
+	if(getsockname(sockfd, &addr.sa, &addr.len)) {
+		uprintf("getsockname() failed: %s\n", net_strerror(net_error()));
+		return NULL;
+	}
+	struct NetPinger *pinger = malloc(sizeof(*pinger));
+	if(!pinger) {
+		uprintf("alloc error\n");
+		return NULL;
+	}
+	pinger->responder = NetPingResponder_new();
+	pinger->sockfd = net_bind_udp(ntohs((addr.sa.sa_family == AF_INET) ? addr.in.sin_port : addr.in6.sin6_port), true);
+	if(!pinger->responder || pinger->sockfd == -1) {
+		if(pinger->sockfd != -1)
+			net_close(pinger->sockfd);
+		free(pinger->responder);
+		free(pinger);
+		return NULL;
+	}
+	atomic_init(&pinger->run, false);
+	return pinger;
+}
+
+static bool NetPinger_start(struct NetPinger *pinger) {
+	atomic_store(&pinger->run, true);
+	if(pthread_create(&pinger->thread, NULL, (void *(*)(void*))NetPinger_run, pinger)) {
+		atomic_store(&pinger->run, false);
+		uprintf("pthread_create() failed\n");
+		return true;
+	}
+	return false;
+}
+
+static void NetPinger_free(struct NetPinger *pinger) {
+	if(!pinger)
+		return;
+	if(atomic_exchange(&pinger->run, false)) {
+		shutdown(pinger->sockfd, SHUT_RDWR);
+		pthread_join(pinger->thread, NULL);
+	}
+	net_close(pinger->sockfd);
+	free(pinger->responder);
+	free(pinger);
+}
+
+// Steers every datagram whose first byte marks a ping to the socket bound after `sockfd`
+static bool net_attach_ping_filter(int32_t sockfd) {
+	struct sock_filter program[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0), // first byte of the UDP payload
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 1, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog fprog = {.len = lengthof(program), .filter = program};
+	if(setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog))) {
+		uprintf("Ping steering unavailable: %s\n", net_strerror(net_error()));
+		return true;
+	}
+	return false;
+}
+
+// Starts a pinger for a context which is the only socket on its port; pings keep being answered in `net_recv()` if this fails
+static void net_init_pinger(struct NetContext *ctx) {
+	ctx->pinger = NetPinger_new(ctx->sockfd);
+	if(ctx->pinger && (NetPinger_start(ctx->pinger) || net_attach_ping_filter(ctx->sockfd))) {
+		NetPinger_free(ctx->pinger);
+		ctx->pinger = NULL;
+	}
+}
+
+#define NET_INBOX_SIZE 128
+#define NET_STEER_MAX 65536 // eBPF map capacity; addresses beyond this are still served through handoffs
+#define NET_SHARD_NONE UINT16_MAX
+#define NET_SHARD_TOMBSTONE (UINT16_MAX - 1)
+#define NET_EXPECT_SLOTS 1024
+#define NET_PROBE_RATE 256 // datagrams per second a shard may offer to all others when no shard expects their IP
+#define NET_PROBE_PER_SOURCE 4
+#define NET_PROBE_HEADER 21 // encrypted `PacketEncryptionLayer`: flag, sequence number and IV
+
+struct NetInbox {
+	pthread_mutex_t mutex;
+	int32_t eventfd; // signalled when the inbox becomes non-empty, registered with the owning context's `pollfd`
+	uint32_t head;
+	atomic_uint count;
+	struct NetInboxSlot {
+		struct SS addr;
+		uint16_t len;
+		NetOrigin origin;
+		uint64_t arrival;
+		uint8_t data[NET_RECV_BUFFER_SIZE];
+	} slots[NET_INBOX_SIZE];
+	struct NetInboxSlot current; // copy of the datagram being processed by the owning thread
+	struct NetRecvSlot currentSlot;
+	_Atomic uint32_t expected[NET_EXPECT_SLOTS]; // sessions of the owning shard by a hash of their client's IP, see `net_expect_ip()`; written by the owning thread only
+	struct NetRateLimit probeLimit; // owning thread only; for probing every shard with datagrams from IPs none of them expects
+};
+
+struct NetSteerEntry {
+	struct NetAddrKey key;
+	uint16_t shard;
+};
+
+struct NetShardGroup {
+	pthread_rwlock_t lock; // guards `shards` and the steering table
+	uint32_t count, joined;
+	uint32_t steer_capacity, steer_used, steer_live;
+	struct NetSteerEntry *steer; // open addressing, maps client addresses to the shard owning their session
+	int32_t bpfMap, bpfSocks; // mirror of `steer` consulted by the kernel, or -1 if eBPF steering is unavailable
+	struct NetPinger *pinger; // bound after every shard, so its socket follows theirs in the reuseport group
+	struct NetContext *shards[];
+};
+
+static struct NetSteerEntry *NetShardGroup_find(struct NetShardGroup *group, const struct NetAddrKey *key, bool insert) {
+	struct NetSteerEntry *tombstone = NULL;
+	for(uint32_t mask = group->steer_capacity - 1, i = NetAddrKey_hash(key) & mask;; i = (i + 1) & mask) {
+		struct NetSteerEntry *entry = &group->steer[i];
+		if(entry->shard == NET_SHARD_NONE)
+			return insert ? (tombstone ? tombstone : entry) : NULL;
+		if(entry->shard == NET_SHARD_TOMBSTONE) {
+			if(!tombstone)
+				tombstone = entry;
+		} else if(memcmp(&entry->key, key, sizeof(*key)) == 0) {
+			return entry;
+		}
+	}
+}
+
+static bool NetShardGroup_rehash(struct NetShardGroup *group, uint32_t capacity) {
+	struct NetSteerEntry *old = group->steer, *old_end = &old[group->steer_capacity];
+	group->steer = malloc(capacity * sizeof(*group->steer));
+	if(!group->steer) {
+		group->steer = old;
+		return true;
+	}
+	for(uint32_t i = 0; i < capacity; ++i)
+		group->steer[i].shard = NET_SHARD_NONE;
+	group->steer_capacity = capacity;
+	group->steer_used = group->steer_live;
+	for(struct NetSteerEntry *it = old; it < old_end; ++it)
+		if(it->shard < NET_SHARD_TOMBSTONE)
+			*NetShardGroup_find(group, &it->key, true) = *it;
+	free(old);
+	return false;
+}
+
+static int32_t net_bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+	return (int32_t)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static void NetShardGroup_bpf_update(struct NetShardGroup *group, const struct NetAddrKey *key, uint16_t shard) {
+	if(group->bpfMap == -1)
+		return;
+	if(shard == NET_SHARD_NONE)
+		net_bpf(BPF_MAP_DELETE_ELEM, &(union bpf_attr){.map_fd = (uint32_t)group->bpfMap, .key = (uintptr_t)key});
+	else
+		net_bpf(BPF_MAP_UPDATE_ELEM, &(union bpf_attr){.map_fd = (uint32_t)group->bpfMap, .key = (uintptr_t)key, .value = (uintptr_t)&(uint32_t){shard}, .flags = BPF_ANY});
+}
+
+// Routes all further datagrams from `key` to `shard`
+static void NetShardGroup_steer(struct NetShardGroup *group, const struct NetAddrKey *key, uint16_t shard) {
+	pthread_rwlock_wrlock(&group->lock);
+	if((group->steer_used + 1) * 2 > group->steer_capacity && NetShardGroup_rehash(group, (group->steer_live * 4 >= group->steer_capacity) ? group->steer_capacity * 2 : group->steer_capacity)) {
+		pthread_rwlock_unlock(&group->lock);
+		return; // not fatal; datagrams from this address will keep being handed off
+	}
+	struct NetSteerEntry *entry = NetShardGroup_find(group, key, true);
+	if(entry->shard == NET_SHARD_NONE)
+		++group->steer_used;
+	if(entry->shard >= NET_SHARD_TOMBSTONE)
+		++group->steer_live;
+	*entry = (struct NetSteerEntry){*key, shard};
+	NetShardGroup_bpf_update(group, key, shard);
+	pthread_rwlock_unlock(&group->lock);
+}
+
+// Removes the route for `key` unless another shard has claimed it since
+static void NetShardGroup_unsteer(struct NetShardGroup *group, const struct NetAddrKey *key, uint16_t shard) {
+	pthread_rwlock_wrlock(&group->lock);
+	struct NetSteerEntry *entry = NetShardGroup_find(group, key, false);
+	if(entry && entry->shard == shard) {
+		entry->shard = NET_SHARD_TOMBSTONE;
+		--group->steer_live;
+		NetShardGroup_bpf_update(group, key, NET_SHARD_NONE);
+	}
+	pthread_rwlock_unlock(&group->lock);
+}
+
+static uint16_t NetShardGroup_lookup(struct NetShardGroup *group, const struct NetAddrKey *key) {
+	pthread_rwlock_rdlock(&group->lock);
+	const struct NetSteerEntry *entry = NetShardGroup_find(group, key, false);
+	uint16_t shard = entry ? entry->shard : NET_SHARD_NONE;
+	pthread_rwlock_unlock(&group->lock);
+	return shard;
+}
+
+#define EBPF_INSN(c, dst, src, o, i) ((struct bpf_insn){.code = (c), .dst_reg = (dst), .src_reg = (src), .off = (o), .imm = (i)})
+#define EBPF_MOV_REG(dst, src) EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0)
+#define EBPF_MOV_IMM(dst, i) EBPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, i)
+#define EBPF_ADD_IMM(dst, i) EBPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, i)
+#define EBPF_MOD32_IMM(dst, i) EBPF_INSN(BPF_ALU | BPF_MOD | BPF_K, dst, 0, 0, i)
+#define EBPF_LDX(size, dst, src, o) EBPF_INSN(BPF_LDX | BPF_MEM | (size), dst, src, o, 0)
+#define EBPF_STX(size, dst, src, o) EBPF_INSN(BPF_STX | BPF_MEM | (size), dst, src, o, 0)
+#define EBPF_ST(size, dst, o, i) EBPF_INSN(BPF_ST | BPF_MEM | (size), dst, 0, o, i)
+#define EBPF_JMP_IMM(op, dst, i, o) EBPF_INSN(BPF_JMP | (op) | BPF_K, dst, 0, o, i)
+#define EBPF_CALL(func) EBPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, func)
+#define EBPF_EXIT() EBPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+#define EBPF_LD_MAP_FD(dst, fd) EBPF_INSN(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd), EBPF_INSN(0, 0, 0, 0, 0)
+
+// Selects the socket of the shard registered for the sender's address in `bpfMap`, falling back to the packet's hash otherwise. Pings go to `pinger`, if any.
+static bool NetShardGroup_attach_ebpf(struct NetShardGroup *group) {
+	group->bpfMap = net_bpf(BPF_MAP_CREATE, &(union bpf_attr){
+		.map_type = BPF_MAP_TYPE_HASH,
+		.key_size = sizeof(struct NetAddrKey),
+		.value_size = sizeof(uint32_t),
+		.max_entries = NET_STEER_MAX,
+	});
+	group->bpfSocks = net_bpf(BPF_MAP_CREATE, &(union bpf_attr){
+		.map_type = BPF_MAP_TYPE_REUSEPORT_SOCKARRAY,
+		.key_size = sizeof(uint32_t),
+		.value_size = sizeof(uint64_t),
+		.max_entries = group->count + 1,
+	});
+	if(group->bpfMap == -1 || group->bpfSocks == -1)
+		goto fail;
+	for(uint32_t i = 0; i < group->count; ++i)
+		if(net_bpf(BPF_MAP_UPDATE_ELEM, &(union bpf_attr){.map_fd = (uint32_t)group->bpfSocks, .key = (uintptr_t)&i, .value = (uintptr_t)&(uint64_t){(uint64_t)group->shards[i]->sockfd}, .flags = BPF_ANY}))
+			goto fail;
+	if(group->pinger && net_bpf(BPF_MAP_UPDATE_ELEM, &(union bpf_attr){.map_fd = (uint32_t)group->bpfSocks, .key = (uintptr_t)&group->count, .value = (uintptr_t)&(uint64_t){(uint64_t)group->pinger->sockfd}, .flags = BPF_ANY}))
+		goto fail;
+	enum { // stack layout: 18 byte `struct NetAddrKey` at -24, selected shard at -4
+		KEY = -24,
+		KEY_MAPPED = KEY + 10,
+		KEY_IPV4 = KEY + 12,
+		KEY_PORT = KEY + 16,
+		INDEX = -4,
+	};
+	const struct bpf_insn ping[] = {
+		EBPF_MOV_REG(BPF_REG_6, BPF_REG_1),
+		EBPF_MOV_IMM(BPF_REG_2, 8), // first byte after the UDP header
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, INDEX),
+		EBPF_MOV_IMM(BPF_REG_4, 1),
+		EBPF_CALL(BPF_FUNC_skb_load_bytes),
+		EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0, 13),
+		EBPF_LDX(BPF_B, BPF_REG_2, BPF_REG_10, INDEX),
+		EBPF_JMP_IMM(BPF_JLE, BPF_REG_2, 1, 11),
+		EBPF_ST(BPF_W, BPF_REG_10, INDEX, (int32_t)group->count),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		EBPF_LD_MAP_FD(BPF_REG_2, group->bpfSocks),
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, INDEX),
+		EBPF_MOV_IMM(BPF_REG_4, 0),
+		EBPF_CALL(BPF_FUNC_sk_select_reuseport),
+		EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0, 2),
+		EBPF_MOV_IMM(BPF_REG_0, SK_PASS),
+		EBPF_EXIT(),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6), // not a ping; `steer` expects the context in R1
+	}, steer[] = {
+		EBPF_MOV_REG(BPF_REG_6, BPF_REG_1),
+		EBPF_ST(BPF_DW, BPF_REG_10, -24, 0),
+		EBPF_ST(BPF_DW, BPF_REG_10, -16, 0),
+		EBPF_ST(BPF_DW, BPF_REG_10, -8, 0),
+		EBPF_LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct sk_reuseport_md, eth_protocol)),
+		EBPF_JMP_IMM(BPF_JNE, BPF_REG_2, htons(ETH_P_IP), 9),
+		EBPF_ST(BPF_H, BPF_REG_10, KEY_MAPPED, 0xffff),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		EBPF_MOV_IMM(BPF_REG_2, 12), // iphdr.saddr
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, KEY_IPV4),
+		EBPF_MOV_IMM(BPF_REG_4, 4),
+		EBPF_MOV_IMM(BPF_REG_5, BPF_HDR_START_NET),
+		EBPF_CALL(BPF_FUNC_skb_load_bytes_relative),
+		EBPF_JMP_IMM(BPF_JA, 0, 0, 7),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		EBPF_MOV_IMM(BPF_REG_2, 8), // ipv6hdr.saddr
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, KEY),
+		EBPF_MOV_IMM(BPF_REG_4, 16),
+		EBPF_MOV_IMM(BPF_REG_5, BPF_HDR_START_NET),
+		EBPF_CALL(BPF_FUNC_skb_load_bytes_relative),
+		EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0, 15),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		EBPF_MOV_IMM(BPF_REG_2, 0), // udphdr.source
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, KEY_PORT),
+		EBPF_MOV_IMM(BPF_REG_4, 2),
+		EBPF_CALL(BPF_FUNC_skb_load_bytes),
+		EBPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0, 8),
+		EBPF_LD_MAP_FD(BPF_REG_1, group->bpfMap),
+		EBPF_MOV_REG(BPF_REG_2, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_2, KEY),
+		EBPF_CALL(BPF_FUNC_map_lookup_elem),
+		EBPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+		EBPF_LDX(BPF_W, BPF_REG_2, BPF_REG_0, 0),
+		EBPF_JMP_IMM(BPF_JA, 0, 0, 2),
+		EBPF_LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct sk_reuseport_md, hash)), // unknown sender; the kernel's own fallback could pick `pinger`
+		EBPF_MOD32_IMM(BPF_REG_2, group->count),
+		EBPF_STX(BPF_W, BPF_REG_10, BPF_REG_2, INDEX),
+		EBPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		EBPF_LD_MAP_FD(BPF_REG_2, group->bpfSocks),
+		EBPF_MOV_REG(BPF_REG_3, BPF_REG_10),
+		EBPF_ADD_IMM(BPF_REG_3, INDEX),
+		EBPF_MOV_IMM(BPF_REG_4, 0),
+		EBPF_CALL(BPF_FUNC_sk_select_reuseport),
+		EBPF_MOV_IMM(BPF_REG_0, SK_PASS),
+		EBPF_EXIT(),
+	};
+	struct bpf_insn program[lengthof(ping) + lengthof(steer)];
+	uint32_t program_len = 0;
+	if(group->pinger) {
+		memcpy(program, ping, sizeof(ping));
+		program_len = lengthof(ping);
+	}
+	memcpy(&program[program_len], steer, sizeof(steer));
+	program_len += lengthof(steer);
+	int32_t prog = net_bpf(BPF_PROG_LOAD, &(union bpf_attr){
+		.prog_type = BPF_PROG_TYPE_SK_REUSEPORT,
+		.insn_cnt = program_len,
+		.insns = (uintptr_t)program,
+		.license = (uintptr_t)"Unlicense",
+	});
+	if(prog == -1)
+		goto fail;
+	int res = setsockopt(group->shards[0]->sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF, &prog, sizeof(prog));
+	close(prog); // the reuseport group holds its own reference
+	if(res)
+		goto fail;
+	for(const struct NetSteerEntry *it = group->steer, *end = &it[group->steer_capacity]; it < end; ++it)
+		if(it->shard < NET_SHARD_TOMBSTONE)
+			NetShardGroup_bpf_update(group, &it->key, it->shard);
+	return false;
+	fail:
+	uprintf("eBPF steering unavailable: %s\n", net_strerror(net_error()));
+	if(group->bpfMap != -1)
+		close(group->bpfMap);
+	if(group->bpfSocks != -1)
+		close(group->bpfSocks);
+	group->bpfMap = -1;
+	group->bpfSocks = -1;
+	return true;
+}
+
+// Unprivileged fallback: spreads senders across shards by source address, leaving the rest to handoffs
+static bool NetShardGroup_attach_cbpf(struct NetShardGroup *group) {
+	const struct sock_filter ping[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0), // first byte of the UDP payload
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 1, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, group->count),
+	}, steer[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, (uint32_t)SKF_AD_OFF + SKF_AD_PROTOCOL),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 2, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 12), // iphdr.saddr
+		BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 20), // last word of ipv6hdr.saddr
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761u),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, group->count),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_filter program[lengthof(ping) + lengthof(steer)];
+	uint16_t program_len = 0;
+	if(group->pinger) {
+		memcpy(program, ping, sizeof(ping));
+		program_len = lengthof(ping);
+	}
+	memcpy(&program[program_len], steer, sizeof(steer));
+	program_len += lengthof(steer);
+	struct sock_fprog fprog = {.len = program_len, .filter = program};
+	if(setsockopt(group->shards[0]->sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog))) {
+		uprintf("cBPF steering unavailable: %s\n", net_strerror(net_error()));
+		return true;
+	}
+	return false;
+}
+
+static bool NetInbox_push(struct NetInbox *inbox, const struct NetRecvSlot *slot, NetOrigin origin) {
+	pthread_mutex_lock(&inbox->mutex);
+	uint32_t count = atomic_load(&inbox->count);
+	if(count >= lengthof(inbox->slots)) {
+		pthread_mutex_unlock(&inbox->mutex);
+		return false;
+	}
+	struct NetInboxSlot *out = &inbox->slots[(inbox->head + count) % lengthof(inbox->slots)];
+	out->addr = slot->addr;
+	out->len = (uint16_t)slot->len;
+	out->origin = origin;
+	out->arrival = slot->arrival;
+	memcpy(out->data, slot->data, slot->len);
+	atomic_store(&inbox->count, count + 1);
+	pthread_mutex_unlock(&inbox->mutex);
+	if(count == 0 && write(inbox->eventfd, &(uint64_t){1}, sizeof(uint64_t)) != sizeof(uint64_t))
+		uprintf("eventfd write failed: %s\n", net_strerror(net_error()));
+	return true;
+}
+
+static const struct NetRecvSlot *NetInbox_pop(struct NetInbox *inbox) {
+	if(!atomic_load(&inbox->count))
+		return NULL;
+	pthread_mutex_lock(&inbox->mutex);
+	inbox->current = inbox->slots[inbox->head];
+	inbox->head = (inbox->head + 1) % lengthof(inbox->slots);
+	atomic_fetch_sub(&inbox->count, 1);
+	pthread_mutex_unlock(&inbox->mutex);
+	inbox->currentSlot = (struct NetRecvSlot){
+		.addr = inbox->current.addr,
+		.len = inbox->current.len,
+		.data = inbox->current.data,
+		.origin = inbox->current.origin,
+		.arrival = inbox->current.arrival,
+	};
+	return &inbox->currentSlot;
+}
+
+static struct NetInbox *NetInbox_new() {
+	struct NetInbox *inbox = malloc(sizeof(*inbox));
+	if(!inbox)
+		return NULL;
+	inbox->head = 0;
+	atomic_init(&inbox->count, 0);
+	for(uint32_t i = 0; i < NET_EXPECT_SLOTS; ++i)
+		atomic_init(&inbox->expected[i], 0);
+	NetRateLimit_init(&inbox->probeLimit, NET_PROBE_RATE);
+	inbox->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(inbox->eventfd == -1 || pthread_mutex_init(&inbox->mutex, NULL)) {
+		if(inbox->eventfd != -1)
+			close(inbox->eventfd);
+		free(inbox);
+		return NULL;
+	}
+	return inbox;
+}
+
+static void NetInbox_free(struct NetInbox *inbox) {
+	if(!inbox)
+		return;
+	pthread_mutex_destroy(&inbox->mutex);
+	close(inbox->eventfd);
+	free(inbox);
+}
+
+static uint32_t net_expect_slot(const struct NetAddrKey *key) {
+	struct NetAddrKey ip = *key;
+	ip.port = 0;
+	return NetAddrKey_hash(&ip) % NET_EXPECT_SLOTS;
+}
+
+// Forwards a datagram to its owning shard
+static void net_handoff(struct NetContext *ctx, uint16_t owner, const struct NetRecvSlot *slot) {
+	struct NetShardGroup *group = ctx->shardGroup;
+	pthread_rwlock_rdlock(&group->lock);
+	if(group->shards[owner] && !NetInbox_push(group->shards[owner]->inbox, slot, NetOrigin_Handoff))
+		++ctx->shardStats.dropped;
+	pthread_rwlock_unlock(&group->lock);
+	++ctx->shardStats.handoffs;
+}
+
+// Offers a datagram which resolved to nothing here to the other shards expecting its IP. If none do, every other shard gets it within `NET_PROBE_RATE`, for clients reaching the instance from a different IP than the master saw.
+static void net_probe(struct NetContext *ctx, const struct NetRecvSlot *slot) {
+	if(slot->data[0] != 1 || slot->len < NET_PROBE_HEADER + 16 || (slot->len - NET_PROBE_HEADER) % 16) { // can't decrypt against any session
+		++ctx->shardStats.limited;
+		return;
+	}
+	struct NetShardGroup *group = ctx->shardGroup;
+	const struct NetAddrKey key = SS_key(&slot->addr);
+	uint32_t expectSlot = net_expect_slot(&key), targets = 0;
+	bool expected = atomic_load_explicit(&ctx->inbox->expected[expectSlot], memory_order_relaxed) != 0;
+	pthread_rwlock_rdlock(&group->lock);
+	for(uint32_t pass = 0; pass < 2 && !targets; ++pass) {
+		if(pass && (expected || !NetRateLimit_accept(&ctx->inbox->probeLimit, NET_PROBE_RATE, NET_PROBE_PER_SOURCE, &slot->addr, ctx->clock.ms)))
+			break;
+		for(uint32_t i = 0; i < group->count; ++i) {
+			if(i == ctx->shardIndex || !group->shards[i])
+				continue;
+			if(!pass && !atomic_load_explicit(&group->shards[i]->inbox->expected[expectSlot], memory_order_relaxed))
+				continue;
+			++targets;
+			if(!NetInbox_push(group->shards[i]->inbox, slot, NetOrigin_Probe))
+				++ctx->shardStats.dropped;
+		}
+	}
+	pthread_rwlock_unlock(&group->lock);
+	if(targets)
+		++ctx->shardStats.probes;
+	else
+		++ctx->shardStats.limited;
+}
+
+// Counts a session of this shard whose client is expected on `key`'s IP, or stops counting it. Other shards probe this one only with datagrams from IPs it expects.
+void net_expect_ip(struct NetContext *ctx, const struct NetAddrKey *key, bool expect) {
+	if(!ctx->inbox)
+		return;
+	_Atomic uint32_t *count = &ctx->inbox->expected[net_expect_slot(key)];
+	uint32_t value = atomic_load_explicit(count, memory_order_relaxed);
+	atomic_store_explicit(count, expect ? value + 1 : value - 1, memory_order_relaxed);
+}
+
+struct NetShardGroup *net_shard_group_new(uint32_t count) {
+	if(count < 1 || count >= NET_SHARD_TOMBSTONE) {
+		uprintf("Invalid shard count\n");
+		return NULL;
+	}
+	struct NetShardGroup *group = malloc(sizeof(*group) + count * sizeof(*group->shards));
+	if(!group) {
+		uprintf("alloc error\n");
+		return NULL;
+	}
+	*group = (struct NetShardGroup){
+		.count = count,
+		.joined = 0,
+		.steer_capacity = 0,
+		.steer_used = 0,
+		.steer_live = 0,
+		.steer = NULL,
+		.bpfMap = -1,
+		.bpfSocks = -1,
+		.pinger = NULL,
+	};
+	for(uint32_t i = 0; i < count; ++i)
+		group->shards[i] = NULL;
+	if(pthread_rwlock_init(&group->lock, NULL) || NetShardGroup_rehash(group, 256)) {
+		uprintf("net_shard_group_new() failed\n");
+		free(group->steer);
+		free(group);
+		return NULL;
+	}
+	return group;
+}
+
+void net_shard_group_free(struct NetShardGroup *group) {
+	if(!group)
+		return;
+	NetPinger_free(group->pinger);
+	if(group->bpfMap != -1)
+		close(group->bpfMap);
+	if(group->bpfSocks != -1)
+		close(group->bpfSocks);
+	pthread_rwlock_destroy(&group->lock);
+	free(group->steer);
+	free(group);
+}
+
+static bool NetShardGroup_join(struct NetShardGroup *group, struct NetContext *ctx) {
+	pthread_rwlock_wrlock(&group->lock);
+	if(group->joined >= group->count) {
+		pthread_rwlock_unlock(&group->lock);
+		uprintf("Shard group full\n");
+		return true;
+	}
+	ctx->shardIndex = (uint16_t)group->joined;
+	group->shards[group->joined++] = ctx;
+	if(group->joined == group->count && net_usePinger) {
+		group->pinger = NetPinger_new(ctx->sockfd);
+		if(group->pinger && NetPinger_start(group->pinger)) {
+			NetPinger_free(group->pinger);
+			group->pinger = NULL;
+		}
+	}
+	if(group->joined == group->count && (group->count > 1 || group->pinger)) {
+		if(!NetShardGroup_attach_ebpf(group)) {
+			uprintf("Steering %u shards with eBPF\n", group->count);
+		} else if(!NetShardGroup_attach_cbpf(group)) {
+			uprintf("Steering %u shards with cBPF\n", group->count);
+		} else if(group->pinger) { // nothing steers pings to it, and its socket would take a share of the game traffic; the shards keep answering them
+			NetPinger_free(group->pinger);
+			group->pinger = NULL;
+		}
+	}
+	pthread_rwlock_unlock(&group->lock);
+	return false;
+}
+#else
+struct NetShardGroup *net_shard_group_new(uint32_t) {
+	uprintf("Sharded sockets are not supported on this platform\n");
+	return NULL;
+}
+
+void net_shard_group_free(struct NetShardGroup*) {}
+
+void net_expect_ip(struct NetContext*, const struct NetAddrKey*, bool) {}
+#endif
+
+// Shared between `net_sync()` and the command it posts; freed by whichever lets go last
+struct NetFence {
+	_Atomic uint32_t refs;
+	_Atomic bool done;
+};
+
+static void NetFence_release(struct NetFence *fence) {
+	if(atomic_fetch_sub_explicit(&fence->refs, 1, memory_order_acq_rel) == 1)
+		free(fence);
+}
+
+struct NetCommand {
+	_Atomic(struct NetCommand*) next;
+	NetCommandType type;
+	union WireLink *from;
+	union {
+		struct WireMessage message;
+		struct NetFence *fence;
+	};
+};
+
+// Intrusive MPSC queue: any thread may push, only the owning thread pops
+struct NetCommandQueue {
+	_Atomic(struct NetCommand*) tail; // most recently posted command, swapped in by producers
+	struct NetCommand *head; // next command to run
+	struct NetCommand stub; // keeps the queue non-empty, so producers never touch `head`
+	#ifdef WINDOWS
+	struct SS wakeAddr; // loopback address of the context's own socket; an empty datagram wakes `select()`
+	#else
+	int32_t eventfd; // registered with the owning context's `pollfd`
+	#endif
+};
+
+static void NetCommandQueue_push(struct NetCommandQueue *queue, struct NetCommand *command) {
+	atomic_store_explicit(&command->next, NULL, memory_order_relaxed);
+	struct NetCommand *prev = atomic_exchange_explicit(&queue->tail, command, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, command, memory_order_release);
+}
+
+static struct NetCommand *NetCommandQueue_pop(struct NetCommandQueue *queue) {
+	struct NetCommand *head = queue->head, *next = atomic_load_explicit(&head->next, memory_order_acquire);
+	if(head == &queue->stub) {
+		if(!next)
+			return NULL;
+		queue->head = head = next;
+		next = atomic_load_explicit(&head->next, memory_order_acquire);
+	}
+	if(!next) {
+		if(head != atomic_load_explicit(&queue->tail, memory_order_acquire))
+			return NULL; // a producer is between its exchange and its link; its wakeup follows
+		NetCommandQueue_push(queue, &queue->stub);
+		next = atomic_load_explicit(&head->next, memory_order_acquire);
+		if(!next)
+			return NULL;
+	}
+	queue->head = next;
+	return head;
+}
+
+static struct NetCommandQueue *NetCommandQueue_new(int32_t sockfd) {
+	struct NetCommandQueue *queue = malloc(sizeof(*queue));
+	if(!queue)
+		return NULL;
+	atomic_init(&queue->stub.next, NULL);
+	atomic_init(&queue->tail, &queue->stub);
+	queue->head = &queue->stub;
+	#ifdef WINDOWS
+	queue->wakeAddr.len = sizeof(struct sockaddr_storage);
+	if(sockfd == -1 || getsockname(sockfd, &queue->wakeAddr.sa, &queue->wakeAddr.len)) {
+		free(queue);
+		return NULL;
+	}
+	if(queue->wakeAddr.sa.sa_family == AF_INET)
+		queue->wakeAddr.in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	else
+		queue->wakeAddr.in6.sin6_addr = in6addr_loopback;
+	#else
+	(void)sockfd;
+	queue->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(queue->eventfd == -1) {
+		free(queue);
+		return NULL;
+	}
+	#endif
+	return queue;
+}
+
+static void NetCommandQueue_free(struct NetCommandQueue *queue) {
+	if(!queue)
+		return;
+	for(struct NetCommand *command; (command = NetCommandQueue_pop(queue)); free(command)) // never run; a waiting `net_sync()` sees the context stopped
+		if(command->type == NetCommandType_Fence)
+			NetFence_release(command->fence);
+	#ifndef WINDOWS
+	close(queue->eventfd);
+	#endif
+	free(queue);
+}
+
+static void net_push_command(struct NetContext *ctx, struct NetCommand *command) {
+	NetCommandQueue_push(ctx->commands, command);
+	#ifdef WINDOWS
+	sendto(ctx->sockfd, "", 0, 0, &ctx->commands->wakeAddr.sa, ctx->commands->wakeAddr.len);
+	#else
+	if(write(ctx->commands->eventfd, &(uint64_t){1}, sizeof(uint64_t)) != sizeof(uint64_t))
+		uprintf("eventfd write failed: %s\n", net_strerror(net_error()));
+	#endif
+}
+
+// Hands work to the thread owning `ctx`; safe to call from any thread
+bool net_post(struct NetContext *ctx, NetCommandType type, union WireLink *from, const struct WireMessage *message) {
+	struct NetCommand *command = malloc(sizeof(*command));
+	if(!command) {
+		uprintf("alloc error\n");
+		return true;
+	}
+	command->type = type;
+	command->from = from;
+	if(message)
+		command->message = *message;
+	net_push_command(ctx, command);
+	return false;
+}
+
+// Blocks until the thread owning `ctx` has run everything posted to it so far, or has stopped. Nothing posted before can reach a context freed afterwards.
+void net_sync(struct NetContext *ctx) {
+	struct NetFence *fence = malloc(sizeof(*fence));
+	struct NetCommand *command = malloc(sizeof(*command));
+	if(!fence || !command) {
+		uprintf("alloc error\n");
+		free(fence);
+		free(command);
+		return;
+	}
+	atomic_init(&fence->refs, 2);
+	atomic_init(&fence->done, false);
+	command->type = NetCommandType_Fence;
+	command->from = NULL;
+	command->fence = fence;
+	net_push_command(ctx, command);
+	while(!atomic_load(&fence->done) && atomic_load(&ctx->run))
+		usleep(1000);
+	NetFence_release(fence);
+}
+
+static void net_run_commands(struct NetContext *ctx) {
+	for(struct NetCommand *command; (command = NetCommandQueue_pop(ctx->commands)); free(command)) {
+		switch(command->type) {
+			case NetCommandType_WireLink: {
+				if(ctx->onWireLink)
+					ctx->onWireLink(ctx->userptr, command->from);
+				break;
+			}
+			case NetCommandType_WireMessage: ctx->onWireMessage(ctx->userptr, command->from, &command->message); break;
+			case NetCommandType_WireDisconnect: ctx->onWireMessage(ctx->userptr, command->from, NULL); break;
+			case NetCommandType_Fence: {
+				atomic_store(&command->fence->done, true);
+				NetFence_release(command->fence);
+				break;
+			}
+			default:;
+		}
+	}
+}
+
+static bool net_init_internal(struct NetContext *ctx, struct NetShardGroup *group, uint16_t port, bool filterUnencrypted, uint32_t tcpBacklog) {
+	#ifdef WINDOWS
+	const bool reusePort = false;
+	#else
+	const bool reusePort = (group != NULL || net_usePinger); // the pinger of a single socket shares its port
+	#endif
+	*ctx = (struct NetContext){
+		._typeid = WireLinkType_LOCAL,
+		.sockfd = net_bind_udp(port, reusePort),
+		.listenfd = tcpBacklog ? net_bind_tcp(port, tcpBacklog) : -1,
+		.pollfd = -1,
+		.run = false,
+		.filterUnencrypted = filterUnencrypted,
+		.sockReady = false,
+		.drainBudget = NET_DRAIN_BUDGET,
+		.clock = NetClock_at(GetTime()),
+		.recvRing = NetRecvRing_new(net_recvBatch),
+		.recvStats = {0},
+		.sendQueue = NetSendQueue_new(),
+		.sendStats = {0},
+		.pendingArrival = 0,
+		.sockDrops = 0,
+		.sockRecvBuffer = 0,
+		.sockSendBuffer = 0,
+		.sockTuned = 0,
+		.tuneDrops = 0,
+		.tuneTime = 0,
+		.dirtySessions = NULL,
+		.mergeStats = {0},
+		.lockDepth = 0,
+		.owned = false,
+		.commands = NULL,
+		.shardGroup = NULL,
+		.shardIndex = 0,
+		.inbox = NULL,
+		.shardStats = {0},
+		.pings = NetPingResponder_new(),
+		.pinger = NULL,
+		// .ctr_drbg = {},
+		// .entropy = {},
+		// .grp = {},
+		.remoteLinks_len = 0,
+		.cookies_len = 0,
+		.remoteLinks = {NULL},
+		.cookies = NULL,
+		.userptr = NULL,
+		.onResolve = onResolve_stub,
+		.onResend = onResend_stub,
+		.onWireLink = NULL,
+		.onWireMessage = onWireMessage_stub,
+		.perf = perf_init(),
+	};
 	mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
 	mbedtls_entropy_init(&ctx->entropy);
+	IvSource_init(&ctx->ivs, &ctx->ctr_drbg);
 	mbedtls_ecp_group_init(&ctx->grp);
-	pthread_mutexattr_t mutexAttribs;
-	if(pthread_mutexattr_init(&mutexAttribs) ||
-	   pthread_mutexattr_settype(&mutexAttribs, PTHREAD_MUTEX_RECURSIVE) ||
-	   pthread_mutex_init(&ctx->mutex, &mutexAttribs)) {
-		uprintf("pthread_mutex_init() failed\n");
-		goto fail;
-	}
 	if(ctx->sockfd == -1 || (tcpBacklog && ctx->listenfd == -1)) {
 		uprintf("Socket creation failed\n");
 		goto fail;
 	}
+	ctx->commands = NetCommandQueue_new(ctx->sockfd);
+	if(!ctx->recvRing || !ctx->sendQueue || !ctx->pings || !ctx->commands) {
+		uprintf("alloc error\n");
+		goto fail;
+	}
+	atomic_store_explicit(&ctx->sockRecvBuffer, net_get_buffer(ctx->sockfd, SO_RCVBUF), memory_order_relaxed);
+	atomic_store_explicit(&ctx->sockSendBuffer, net_get_buffer(ctx->sockfd, SO_SNDBUF), memory_order_relaxed);
+	#ifndef WINDOWS
+	if(setsockopt(ctx->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &(int){1}, sizeof(int))) // arrival times for `struct NetLatencyStats`
+		uprintf("SO_TIMESTAMPNS unavailable: %s\n", net_strerror(net_error()));
+	int32_t gsoSize = 0;
+	ctx->sendQueue->gso = (getsockopt(ctx->sockfd, SOL_UDP, UDP_SEGMENT, &gsoSize, &(socklen_t){sizeof(gsoSize)}) == 0);
+	if(net_useUring)
+		net_init_uring(ctx);
+	if(net_useGro && !ctx->recvRing->uring) // provided buffers are sized for single datagrams
+		net_init_gro(ctx);
+	ctx->pollfd = epoll_create1(EPOLL_CLOEXEC);
+	if(ctx->pollfd == -1) {
+		uprintf("epoll_create1() failed: %s\n", net_strerror(net_error()));
+		goto fail;
+	}
+	if(epoll_ctl(ctx->pollfd, EPOLL_CTL_ADD, ctx->sockfd, &(struct epoll_event){.events = EPOLLIN | EPOLLET, .data.ptr = NULL}) ||
+	   (ctx->recvRing->uring && epoll_ctl(ctx->pollfd, EPOLL_CTL_ADD, ctx->recvRing->uring->fd, &(struct epoll_event){.events = EPOLLIN | EPOLLET, .data.ptr = NULL})) || // the socket stays registered so `net_stop()` still wakes the loop
+	   (ctx->listenfd != -1 && epoll_ctl(ctx->pollfd, EPOLL_CTL_ADD, ctx->listenfd, &(struct epoll_event){.events = EPOLLIN, .data.ptr = &ctx->listenfd})) ||
+	   epoll_ctl(ctx->pollfd, EPOLL_CTL_ADD, ctx->commands->eventfd, &(struct epoll_event){.events = EPOLLIN, .data.ptr = ctx->commands})) {
+		uprintf("epoll_ctl() failed: %s\n", net_strerror(net_error()));
+		goto fail;
+	}
+	if(group) {
+		ctx->inbox = NetInbox_new();
+		if(!ctx->inbox) {
+			uprintf("NetInbox_new() failed\n");
+			goto fail;
+		}
+		if(epoll_ctl(ctx->pollfd, EPOLL_CTL_ADD, ctx->inbox->eventfd, &(struct epoll_event){.events = EPOLLIN, .data.ptr = ctx->inbox})) {
+			uprintf("epoll_ctl() failed: %s\n", net_strerror(net_error()));
+			goto fail;
+		}
+	}
+	#endif
 	struct SS realAddr = {.len = sizeof(struct sockaddr_storage)};
 	getsockname(ctx->sockfd, &realAddr.sa, &realAddr.len);
 	char namestr[INET6_ADDRSTRLEN + 8];
@@ -352,6 +2190,15 @@ bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, uin
 		uprintf("mbedtls_ecp_group_load() failed\n");
 		goto fail;
 	}
+	#ifndef WINDOWS
+	if(group) {
+		if(NetShardGroup_join(group, ctx))
+			goto fail;
+		ctx->shardGroup = group;
+	} else if(net_usePinger) {
+		net_init_pinger(ctx);
+	}
+	#endif
 	atomic_store(&ctx->run, true);
 	return false;
 	fail:
@@ -359,10 +2206,20 @@ bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, uin
 	return true;
 }
 
+bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, uint32_t tcpBacklog) {
+	return net_init_internal(ctx, NULL, port, filterUnencrypted, tcpBacklog);
+}
+
+// Binds one of `group->count` sockets sharing `port`, each of which should be served by its own thread
+bool net_init_shard(struct NetContext *ctx, struct NetShardGroup *group, uint16_t port, bool filterUnencrypted, uint32_t tcpBacklog) {
+	return net_init_internal(ctx, group, port, filterUnencrypted, tcpBacklog);
+}
+
 static void net_set_mtu(struct NetSession *session, uint8_t idx) {
 	uint32_t oldMtu = session->mtu;
 	session->mtu = PossibleMtu[idx];
 	session->mtuIdx = idx;
+	session->mtuProbes = 0;
 	uprintf("MTU %u -> %u\n", oldMtu, session->mtu);
 	uint8_t buf[NET_MAX_PKT_SIZE], *buf_end = buf;
 	session->maxChanneledSize = session->mtu - (uint16_t)pkt_write_c(&buf_end, endof(buf), session->version, NetPacketHeader, {
@@ -371,13 +2228,63 @@ static void net_set_mtu(struct NetSession *session, uint8_t idx) {
 	session->maxFragmentSize = session->maxChanneledSize - (uint16_t)pkt_write_c(&buf_end, endof(buf), session->version, FragmentedHeader, {0});
 }
 
+// Sends a MtuCheck the size of the next entry in `PossibleMtu`, unmerged so the probe is the whole datagram. Returns false once there is nothing left to probe, either because the largest entry was reached or `NET_MTU_PROBE_ATTEMPTS` probes in a row went unanswered.
+bool net_probe_mtu(struct NetContext *ctx, struct NetSession *session) {
+	if(session->mtuIdx >= lengthof(PossibleMtu) - 1 || session->mtuProbes >= NET_MTU_PROBE_ATTEMPTS)
+		return false;
+	uint32_t mtu = PossibleMtu[session->mtuIdx + 1];
+	uint8_t buf[NET_MAX_PKT_SIZE], *buf_end = buf;
+	pkt_write_c(&buf_end, endof(buf), session->version, NetPacketHeader, {
+		.property = PacketProperty_MtuCheck,
+		.mtuCheck.base = {
+			.newMtu0 = mtu,
+			.newMtu1 = mtu,
+		},
+	});
+	if(buf_end == buf)
+		return false;
+	net_send_internal(ctx, session, buf, (uint32_t)(buf_end - buf), true);
+	#ifndef WINDOWS
+	ctx->sendQueue->slots[ctx->sendQueue->count - 1].gso = false; // a segment larger than the path MTU would sink the whole send
+	#endif
+	++session->mtuProbes;
+	return true;
+}
+
+// Adopts the probed size once the peer echoes a MtuCheck back. Stale echoes of smaller probes are ignored.
+void net_confirm_mtu(struct NetSession *session, uint32_t mtu) {
+	if(session->mtuIdx >= lengthof(PossibleMtu) - 1 || mtu != PossibleMtu[session->mtuIdx + 1])
+		return;
+	net_set_mtu(session, session->mtuIdx + 1);
+}
+
+#ifdef PERFTEST
+static uint64_t GetTime_us() {
+	struct timespec now = GetTime();
+	return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+#endif
+
+static void NetSession_unlinkDirty(struct NetSession *session) {
+	if(!session->dirtyPrev)
+		return;
+	*session->dirtyPrev = session->dirtyNext;
+	if(session->dirtyNext)
+		session->dirtyNext->dirtyPrev = session->dirtyPrev;
+	session->dirtyNext = NULL;
+	session->dirtyPrev = NULL;
+}
+
 void NetSession_init(struct NetContext *ctx, struct NetSession *session, struct SS addr) {
 	*session = (struct NetSession){
 		.version = PV_LEGACY_DEFAULT,
-		.cookie = net_cookie(&ctx->ctr_drbg),
 		.addr = addr,
-		.lastKeepAlive = net_time(),
+		.lastKeepAlive = ctx->clock.ms,
 		.mtu = 0,
+		.gsoRefused = false,
+		.steered = false,
+		.shardIndex = ctx->shardIndex,
+		.shardGroup = ctx->shardGroup,
 		.alive = true,
 		.fragmentId = 0,
 		.mergeData_end = session->mergeData,
@@ -388,10 +2295,26 @@ void NetSession_init(struct NetContext *ctx, struct NetSession *session, struct
 }
 
 void NetSession_free(struct NetSession *session) {
+	NetSession_unlinkDirty(session);
+	#ifndef WINDOWS
+	if(session->steered)
+		NetShardGroup_unsteer(session->shardGroup, &session->steerKey, session->shardIndex);
+	session->steered = false;
+	#endif
 	EncryptionState_free(&session->encryptionState);
 	net_keypair_free(&session->keys);
 }
 
+// Moves an established session to the address its client now sends from; the new address is steered to this shard by the next `net_recv()` returning it
+void NetSession_set_addr(struct NetSession *session, struct SS addr) {
+	session->addr = addr;
+	#ifndef WINDOWS
+	if(session->steered)
+		NetShardGroup_unsteer(session->shardGroup, &session->steerKey, session->shardIndex);
+	session->steered = false;
+	#endif
+}
+
 void net_keypair_init(struct NetContext *ctx, struct NetKeypair *keys) {
 	keys->random = net_cookie(&ctx->ctr_drbg);
 	mbedtls_mpi_init(&keys->secret);
@@ -430,31 +2353,77 @@ void net_cleanup(struct NetContext *ctx) {
 			net_remove_remote(ctx, (mbedtls_ssl_context*)link);
 		}
 	}
-	if(pthread_mutex_destroy(&ctx->mutex)) // TODO: ensure unlock
-		uprintf("pthread_mutex_destroy() failed\n");
+	#ifndef WINDOWS
+	if(ctx->shardGroup) {
+		pthread_rwlock_wrlock(&ctx->shardGroup->lock);
+		ctx->shardGroup->shards[ctx->shardIndex] = NULL;
+		pthread_rwlock_unlock(&ctx->shardGroup->lock);
+		ctx->shardGroup = NULL;
+	}
+	#endif
 	free(ctx->cookies);
+	IvSource_free(&ctx->ivs);
 	mbedtls_entropy_free(&ctx->entropy);
 	mbedtls_ctr_drbg_free(&ctx->ctr_drbg);
+	#ifndef WINDOWS
+	if(ctx->pollfd != -1)
+		close(ctx->pollfd);
+	NetPinger_free(ctx->pinger);
+	ctx->pinger = NULL;
+	#endif
+	free(ctx->pings);
+	ctx->pings = NULL;
+	NetCommandQueue_free(ctx->commands);
+	ctx->commands = NULL;
 	net_close(ctx->listenfd);
 	net_close(ctx->sockfd);
+	NetRecvRing_free(ctx->recvRing);
+	ctx->recvRing = NULL;
+	#ifndef WINDOWS
+	if(ctx->sendQueue)
+		NetUring_free(ctx->sendQueue->uring);
+	#endif
+	free(ctx->sendQueue);
+	ctx->sendQueue = NULL;
+	#ifndef WINDOWS
+	NetInbox_free(ctx->inbox);
+	ctx->inbox = NULL;
+	#endif
 	ctx->_typeid = WireLinkType_INVALID;
 }
 
+// A context belongs to the first thread which locks it; other threads must go through `net_post()` instead
 void net_lock(struct NetContext *ctx) {
-	#if 1
-	if(pthread_mutex_trylock(&ctx->mutex) == 0)
-		return;
-	uprintf("block\n");
+	#ifdef DEBUG
+	if(!ctx->owned) {
+		ctx->owner = pthread_self();
+		ctx->owned = true;
+	} else if(!pthread_equal(ctx->owner, pthread_self())) {
+		uprintf("net_lock() called from a thread not owning the context\n");
+	}
 	#endif
-	pthread_mutex_lock(&ctx->mutex);
+	++ctx->lockDepth;
 }
 
+// Releasing the outermost lock ends the current pass, so nothing queued for sending may outlive it
 void net_unlock(struct NetContext *ctx) {
-	pthread_mutex_unlock(&ctx->mutex);
+	if(--ctx->lockDepth == 0)
+		net_flush_sends(ctx);
+}
+
+static inline int32_t NetContext_remotefd(const mbedtls_ssl_context *link) {
+	return (int32_t)(intptr_t)link->MBEDTLS_PRIVATE(p_bio);
 }
 
 bool net_add_remote(struct NetContext *ctx, mbedtls_ssl_context *link) {
 	uprintf("net_add_remote(%p) %u -> %u\n", link, ctx->remoteLinks_len, ctx->remoteLinks_len + 1);
+	#ifndef WINDOWS
+	// Level-triggered, since `mbedtls_ssl_read()` consumes at most one record per `wire_recv()`
+	if(epoll_ctl(ctx->pollfd, EPOLL_CTL_ADD, NetContext_remotefd(link), &(struct epoll_event){.events = EPOLLIN, .data.ptr = link})) {
+		uprintf("epoll_ctl() failed: %s\n", net_strerror(net_error()));
+		return true;
+	}
+	#endif
 	mbedtls_ssl_context **list;
 	switch(ctx->remoteLinks_len) {
 		case 0: {
@@ -472,6 +2441,9 @@ bool net_add_remote(struct NetContext *ctx, mbedtls_ssl_context *link) {
 	}
 	if(!list) {
 		uprintf("alloc error\n");
+		#ifndef WINDOWS
+		epoll_ctl(ctx->pollfd, EPOLL_CTL_DEL, NetContext_remotefd(link), NULL);
+		#endif
 		return true;
 	}
 	list[ctx->remoteLinks_len++] = link;
@@ -490,6 +2462,9 @@ bool net_remove_remote(struct NetContext *ctx, mbedtls_ssl_context *link) {
 	return true;
 	found:
 	uprintf("net_remove_remote(%p) %u -> %u\n", link, ctx->remoteLinks_len, ctx->remoteLinks_len - 1);
+	#ifndef WINDOWS
+	epoll_ctl(ctx->pollfd, EPOLL_CTL_DEL, NetContext_remotefd(link), NULL);
+	#endif
 	*it = list[--ctx->remoteLinks_len];
 	switch(ctx->remoteLinks_len) {
 		case 0: ctx->remoteLinks.single = NULL; break;
@@ -507,49 +2482,116 @@ bool net_remove_remote(struct NetContext *ctx, mbedtls_ssl_context *link) {
 	return false;
 }
 
+static bool NetContext_hasRemote(struct NetContext *ctx, const mbedtls_ssl_context *link) {
+	for(mbedtls_ssl_context *const *it = NetContext_remoteLinks(ctx), *const *end = &it[ctx->remoteLinks_len]; it < end; ++it)
+		if(*it == link)
+			return true;
+	return false;
+}
+
+// Totals since startup; safe to call from any thread
+void net_get_pingStats(const struct NetContext *ctx, struct NetPingStats *out) {
+	*out = (struct NetPingStats){0};
+	if(ctx->pings)
+		NetPingResponder_collect(ctx->pings, out);
+	#ifndef WINDOWS
+	if(ctx->pinger)
+		NetPingResponder_collect(ctx->pinger->responder, out);
+	if(ctx->shardGroup && ctx->shardIndex == 0 && ctx->shardGroup->pinger) // counted once per group
+		NetPingResponder_collect(ctx->shardGroup->pinger->responder, out);
+	#endif
+}
+
+void net_get_latencyStats(const struct NetContext *ctx, struct NetLatencyStats *out) {
+	for(uint32_t i = 0; i < NET_LATENCY_BUCKETS; ++i) {
+		out->dispatch[i] = atomic_load_explicit(&ctx->dispatchDelay[i], memory_order_relaxed);
+		out->send[i] = atomic_load_explicit(&ctx->sendDelay[i], memory_order_relaxed);
+	}
+}
+
+void net_get_socketStats(const struct NetContext *ctx, struct NetSocketStats *out) {
+	*out = (struct NetSocketStats){
+		.drops = atomic_load_explicit(&ctx->sockDrops, memory_order_relaxed),
+		.recvBuffer = atomic_load_explicit(&ctx->sockRecvBuffer, memory_order_relaxed),
+		.sendBuffer = atomic_load_explicit(&ctx->sockSendBuffer, memory_order_relaxed),
+		.tuned = atomic_load_explicit(&ctx->sockTuned, memory_order_relaxed),
+	};
+}
+
+#ifdef PERFTEST
+static void net_log_stats(const struct NetContext *ctx) {
+	const struct NetRecvStats *stats = &ctx->recvStats;
+	char hist[256], *hist_end = hist;
+	for(uint32_t i = 0; i < lengthof(stats->fill) && (1u << i) <= ctx->recvRing->capacity; ++i)
+		hist_end += snprintf(hist_end, (size_t)(endof(hist) - hist_end), " %u+:%" PRIu64, 1u << i, stats->fill[i]);
+	uprintf("recv: %" PRIu64 " datagrams in %" PRIu64 " batches (avg %.2f, %" PRIu64 " full) [%s ]\n", stats->datagrams, stats->batches,
+		stats->batches ? (double)stats->datagrams / (double)stats->batches : 0., stats->full, hist);
+	if(stats->merged)
+		uprintf("gro: %" PRIu64 " datagrams merged\n", stats->merged);
+	uprintf("send: %" PRIu64 " datagrams in %" PRIu64 " flushes (avg %.2f, %" PRIu64 " errors)\n", ctx->sendStats.datagrams, ctx->sendStats.flushes,
+		ctx->sendStats.flushes ? (double)ctx->sendStats.datagrams / (double)ctx->sendStats.flushes : 0., ctx->sendStats.errors);
+	if(ctx->sendStats.segmented)
+		uprintf("gso: %" PRIu64 " datagrams segmented, %" PRIu64 " sends refused\n", ctx->sendStats.segmented, ctx->sendStats.gsoRefused);
+	if(ctx->mergeStats.flushes) {
+		hist_end = hist;
+		for(uint32_t i = 0; i < lengthof(ctx->mergeStats.holdTime); ++i)
+			if(ctx->mergeStats.holdTime[i])
+				hist_end += snprintf(hist_end, (size_t)(endof(hist) - hist_end), " %uus+:%" PRIu64, 1u << i, ctx->mergeStats.holdTime[i]);
+		uprintf("merge: %" PRIu64 " flushes, %" PRIu64 " at end of batch [%s ]\n", ctx->mergeStats.flushes, ctx->mergeStats.batchFlushes, hist);
+	}
+	struct NetSocketStats sockets;
+	net_get_socketStats(ctx, &sockets);
+	if(sockets.drops)
+		uprintf("socket: %u datagrams dropped by the kernel, receive buffer %u bytes (%u resizes)\n", sockets.drops, sockets.recvBuffer, sockets.tuned);
+	struct NetPingStats pings;
+	net_get_pingStats(ctx, &pings);
+	if(pings.answered || pings.limited || pings.stray)
+		uprintf("ping: %" PRIu64 " answered, %" PRIu64 " limited, %" PRIu64 " stray\n", pings.answered, pings.limited, pings.stray);
+	if(ctx->shardGroup)
+		uprintf("shard %u: %" PRIu64 " handoffs, %" PRIu64 " probes, %" PRIu64 " limited, %" PRIu64 " received, %" PRIu64 " dropped\n", ctx->shardIndex,
+			ctx->shardStats.handoffs, ctx->shardStats.probes, ctx->shardStats.limited, ctx->shardStats.received, ctx->shardStats.dropped);
+}
+#endif
+
+#ifdef WINDOWS
 static inline int32_t max32(int32_t a, int32_t b) {
 	return a > b ? a : b;
 }
 
-static bool net_poll(struct NetContext *ctx, fd_set *fdSet, uint32_t timeout) {
-	FD_ZERO(fdSet);
-	FD_SET(ctx->sockfd, fdSet);
+// Waits up to `timeout` milliseconds, then services any ready wire links. Returns `true` if no sockets became ready.
+static bool net_poll(struct NetContext *ctx, uint32_t timeout) {
+	fd_set fdSet;
+	FD_ZERO(&fdSet);
+	FD_SET(ctx->sockfd, &fdSet);
 	if(ctx->listenfd != -1)
-		FD_SET(ctx->listenfd, fdSet);
+		FD_SET(ctx->listenfd, &fdSet);
 	int32_t fdMax = max32(ctx->sockfd, ctx->listenfd);
 	for(mbedtls_ssl_context **link = NetContext_remoteLinks(ctx), **end = &link[ctx->remoteLinks_len]; link < end; ++link) {
-		int32_t remotefd = (int32_t)(intptr_t)(*link)->MBEDTLS_PRIVATE(p_bio);
-		FD_SET(remotefd, fdSet);
+		int32_t remotefd = NetContext_remotefd(*link);
+		FD_SET(remotefd, &fdSet);
 		fdMax = max32(fdMax, remotefd);
 	}
 	net_unlock(ctx);
 	[[maybe_unused]] struct timespec sleepStart = GetTime();
-	int nfd = select(fdMax + 1, fdSet, NULL, NULL, &(struct timeval){
+	int nfd = select(fdMax + 1, &fdSet, NULL, NULL, &(struct timeval){
 		.tv_sec = timeout / 1000,
 		.tv_usec = (timeout % 1000) * 1000,
 	});
-	[[maybe_unused]] struct timespec sleepEnd = GetTime();
+	struct timespec sleepEnd = GetTime();
+	ctx->clock = NetClock_at(sleepEnd);
 	net_lock(ctx);
 	#ifdef PERFTEST
-	perf_tick(&ctx->perf, sleepStart, sleepEnd);
+	if(perf_tick(&ctx->perf, sleepStart, sleepEnd))
+		net_log_stats(ctx);
 	#endif
 	if(nfd == -1) {
 		uprintf("select() failed: %s\n", net_strerror(net_error()));
-		FD_ZERO(fdSet);
-		FD_SET(ctx->sockfd, fdSet);
 		atomic_store(&ctx->run, false);
+		return false;
 	}
-	return nfd == 0;
-}
-
-uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out) {
-	retry:; // __attribute__((musttail)) not available in all compilers
-	fd_set fdSet;
-	for(uint32_t nextTick = 0; net_poll(ctx, &fdSet, nextTick); nextTick = (nextTick >= 2) ? nextTick : 2)
-		nextTick = ctx->onResend(ctx->userptr, net_time());
 	for(uint32_t i = 0, len = ctx->remoteLinks_len; i < len; ++i) {
 		mbedtls_ssl_context *link = NetContext_remoteLinks(ctx)[i];
-		if(!FD_ISSET((intptr_t)link->MBEDTLS_PRIVATE(p_bio), &fdSet))
+		if(!FD_ISSET(NetContext_remotefd(link), &fdSet))
 			continue;
 		wire_recv(ctx, link); // May invalidate `link` AND `ctx->remoteLinks`
 
@@ -561,64 +2603,256 @@ uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSe
 	}
 	if(ctx->listenfd != -1 && FD_ISSET(ctx->listenfd, &fdSet))
 		wire_accept(ctx, ctx->listenfd);
-	if(!FD_ISSET(ctx->sockfd, &fdSet))
-		goto retry;
-	struct SS addr = {.len = sizeof(struct sockaddr_storage)};
-	uint8_t raw[1536];
-	#ifdef WINSOCK_VERSION
-	ssize_t raw_len = recvfrom(ctx->sockfd, (char*)raw, sizeof(raw), 0, &addr.sa, &addr.len);
+	ctx->sockReady = FD_ISSET(ctx->sockfd, &fdSet);
+	return nfd == 0;
+}
+#else
+// Waits up to `timeout` milliseconds, then services any ready wire links. Returns `true` if no sockets became ready.
+static bool net_poll(struct NetContext *ctx, uint32_t timeout) {
+	struct epoll_event events[NET_POLL_EVENTS];
+	net_unlock(ctx);
+	[[maybe_unused]] struct timespec sleepStart = GetTime();
+	int nfd = epoll_wait(ctx->pollfd, events, lengthof(events), (int)timeout);
+	struct timespec sleepEnd = GetTime();
+	ctx->clock = NetClock_at(sleepEnd);
+	net_lock(ctx);
+	#ifdef PERFTEST
+	if(perf_tick(&ctx->perf, sleepStart, sleepEnd))
+		net_log_stats(ctx);
+	#endif
+	if(nfd == -1) {
+		if(net_error() == EINTR)
+			return false;
+		uprintf("epoll_wait() failed: %s\n", net_strerror(net_error()));
+		atomic_store(&ctx->run, false);
+		return false;
+	}
+	for(const struct epoll_event *event = events; event < &events[nfd]; ++event) {
+		if(event->data.ptr == NULL)
+			ctx->sockReady = true;
+		else if(event->data.ptr == &ctx->listenfd)
+			wire_accept(ctx, ctx->listenfd);
+		else if(event->data.ptr == ctx->inbox)
+			read(ctx->inbox->eventfd, &(uint64_t){0}, sizeof(uint64_t)); // rearm; `net_recv()` checks the inbox itself
+		else if(event->data.ptr == ctx->commands)
+			read(ctx->commands->eventfd, &(uint64_t){0}, sizeof(uint64_t)); // rearm; `net_next_datagram()` runs the commands
+		else if(NetContext_hasRemote(ctx, event->data.ptr)) // earlier events in this batch may have disconnected the link
+			wire_recv(ctx, event->data.ptr);
+	}
+	return nfd == 0;
+}
+#endif
+
+// Sends and resets the merge buffers of up to `NET_MERGE_FLUSH_BATCH` sessions
+static void net_flush_merged_many(struct NetContext *ctx, struct NetSession *const sessions[], uint32_t count) {
+	struct NetSession *sending[NET_MERGE_FLUSH_BATCH];
+	uint32_t sending_len = 0;
+	for(uint32_t i = 0; i < count; ++i)
+		if(sessions[i]->mergeData_end - sessions[i]->mergeData > 3)
+			sending[sending_len++] = sessions[i];
+	if(sending_len)
+		net_send_merged(ctx, sending, sending_len);
+	#ifdef PERFTEST // the hold time is shorter than a batch, so this can't use `ctx->clock`
+	uint64_t now = GetTime_us();
+	for(uint32_t i = 0; i < sending_len; ++i) {
+		uint64_t held = now - sending[i]->mergeSince;
+		uint32_t bucket = held ? 63u - (uint32_t)__builtin_clzll(held) : 0;
+		++ctx->mergeStats.holdTime[(bucket < lengthof(ctx->mergeStats.holdTime)) ? bucket : lengthof(ctx->mergeStats.holdTime) - 1];
+	}
+	#endif
+	ctx->mergeStats.flushes += sending_len;
+	for(uint32_t i = 0; i < count; ++i) {
+		struct NetSession *session = sessions[i];
+		NetSession_unlinkDirty(session);
+		session->mergeData_end = session->mergeData;
+		pkt_write_c(&session->mergeData_end, endof(session->mergeData), session->version, NetPacketHeader, {
+			.property = PacketProperty_Merged,
+			.connectionNumber = 0,
+			.isFragmented = 0,
+		});
+	}
+}
+
+// Sends every merged datagram still being held; called once a receive batch has been fully processed
+static void net_flush_dirty(struct NetContext *ctx) {
+	if(!ctx->dirtySessions)
+		return;
+	while(ctx->dirtySessions) {
+		struct NetSession *batch[NET_MERGE_FLUSH_BATCH];
+		uint32_t count = 0;
+		for(struct NetSession *it = ctx->dirtySessions; it && count < lengthof(batch); it = it->dirtyNext)
+			batch[count++] = it;
+		ctx->mergeStats.batchFlushes += count;
+		net_flush_merged_many(ctx, batch, count);
+	}
+	net_flush_sends(ctx);
+}
+
+// Publishes the kernel's drop counter and grows the receive buffer while drops keep appearing
+static void net_tune_buffers(struct NetContext *ctx) {
+	uint32_t drops = ctx->recvRing->drops;
+	atomic_store_explicit(&ctx->sockDrops, drops, memory_order_relaxed);
+	if(net_autoTune && ctx->clock.ms - ctx->tuneTime < NET_BUFFER_TUNE_INTERVAL_MS)
+		return;
+	ctx->tuneDrops = drops;
+	ctx->tuneTime = ctx->clock.ms;
+	uint32_t size = atomic_load_explicit(&ctx->sockRecvBuffer, memory_order_relaxed);
+	if(!net_autoTune || size >= NET_BUFFER_TUNE_MAX)
+		return;
+	#ifdef WINDOWS
+	uint32_t request = size * 2;
 	#else
-	ssize_t raw_len = recvfrom(ctx->sockfd, raw, sizeof(raw), 0, &addr.sa, &addr.len);
+	uint32_t request = size; // Linux reports twice the requested size to account for bookkeeping overhead
 	#endif
-	if(raw_len <= 0) {
-		if(atomic_load(&ctx->run))
-			goto retry;
-		if(raw_len == -1)
-			uprintf("recvfrom() failed: %s\n", net_strerror(net_error()));
-		return 0;
+	uint32_t grown = net_set_buffer(ctx->sockfd, SO_RCVBUF, NET_SO_RCVBUFFORCE, (request < NET_BUFFER_TUNE_MAX) ? request : NET_BUFFER_TUNE_MAX);
+	if(grown <= size)
+		return;
+	uprintf("%u datagrams dropped; receive buffer grown to %u bytes\n", drops, grown);
+	atomic_store_explicit(&ctx->sockRecvBuffer, grown, memory_order_relaxed);
+	atomic_store_explicit(&ctx->sockTuned, atomic_load_explicit(&ctx->sockTuned, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Returns the next datagram to process, blocking if none are queued. Returns NULL once the context is stopped.
+static const struct NetRecvSlot *net_next_datagram(struct NetContext *ctx) {
+	while(atomic_load(&ctx->run)) {
+		net_run_commands(ctx);
+		if(ctx->sendQueue->count && ctx->clock.ms - ctx->sendQueue->since >= NET_SEND_MAX_WAIT) // the clock advances once per batch, not per datagram
+			net_flush_sends(ctx);
+		#ifndef WINDOWS
+		if(ctx->inbox) {
+			const struct NetRecvSlot *slot = NetInbox_pop(ctx->inbox);
+			if(slot) {
+				++ctx->shardStats.received;
+				ctx->clock = NetClock_at(GetTime());
+				return slot;
+			}
+		}
+		#endif
+		struct NetRecvRing *ring = ctx->recvRing;
+		if(ring->head < ring->count)
+			return &ring->slots[ring->head++];
+		net_flush_dirty(ctx);
+		if(!ctx->sockReady) { // batch consumed; block until the socket or a wire link is ready
+			ctx->drainBudget = NET_DRAIN_BUDGET;
+			for(uint32_t nextTick = 0; net_poll(ctx, nextTick); nextTick = (nextTick >= 2) ? nextTick : 2) {
+				nextTick = ctx->onResend(ctx->userptr, ctx->clock.ms);
+				net_flush_dirty(ctx);
+			}
+			continue;
+		}
+		if(!ctx->drainBudget) { // don't let a flood of game traffic starve the wire links
+			ctx->drainBudget = NET_DRAIN_BUDGET;
+			net_poll(ctx, 0);
+		}
+		int32_t count = NetRecvRing_fill(ring, ctx->sockfd, &ctx->recvStats);
+		#ifdef WINDOWS
+		ctx->sockReady = false; // `select()` is level-triggered; poll again before the next read
+		#endif
+		if(count <= 0) {
+			bool wouldBlock = false;
+			#ifndef WINDOWS
+			wouldBlock = (net_error() == EAGAIN || net_error() == EWOULDBLOCK);
+			#endif
+			if(count == -1 && !wouldBlock && atomic_load(&ctx->run))
+				uprintf("NetRecvRing_fill() failed: %s\n", net_strerror(net_error()));
+			ctx->sockReady = false; // go back through `net_poll()` rather than retrying a failing read
+			continue;
+		}
+		ctx->clock = NetClock_at(GetTime());
+		ctx->drainBudget = (ctx->drainBudget > count) ? ctx->drainBudget - (uint16_t)count : 0;
+		++ctx->recvStats.batches;
+		ctx->recvStats.datagrams += (uint32_t)count;
+		ctx->recvStats.full += (count == ring->capacity);
+		++ctx->recvStats.fill[31 - __builtin_clz((uint32_t)count)];
+		if(ring->drops != ctx->tuneDrops)
+			net_tune_buffers(ctx);
 	}
+	return NULL;
+}
+
+uint32_t net_recv(struct NetContext *ctx, const uint8_t **out, struct NetSession **session, void **userdata_out) {
+	retry:; // __attribute__((musttail)) not available in all compilers
+	const struct NetRecvSlot *slot = net_next_datagram(ctx);
+	if(!slot)
+		return 0;
+	const struct SS addr = slot->addr;
+	uint8_t *const raw = slot->data; // decrypted in place; the slot isn't reused before the next call
+	const uint32_t raw_len = slot->len;
+	if(!raw_len)
+		goto retry;
 	if(addr.sa.sa_family == AF_UNSPEC) {
 		uprintf("UNSPEC\n");
 		goto retry;
 	}
-	if(raw[0] > 1) { // protocol extension for pinging the server
-		sendto(ctx->sockfd, (char*)raw, 1, 0, &addr.sa, addr.len);
-		char namestr[INET6_ADDRSTRLEN + 8];
-		net_tostr(&addr, namestr);
-		// uprintf("ping[%s]: %hhu\n", namestr, raw[0]);
+	if(raw[0] > 1) { // protocol extension for pinging the server; normally steered to `ctx->pinger` instead
+		if(NetPingResponder_accept(ctx->pings, &addr, ctx->clock.ms))
+			sendto(ctx->sockfd, (char*)raw, 1, 0, &addr.sa, addr.len);
 		goto retry;
 	}
+	#ifndef WINDOWS
+	uint16_t owner = NET_SHARD_NONE;
+	if(ctx->shardGroup && slot->origin == NetOrigin_Socket) {
+		const struct NetAddrKey key = SS_key(&addr);
+		owner = NetShardGroup_lookup(ctx->shardGroup, &key);
+		if(owner != NET_SHARD_NONE && owner != ctx->shardIndex) {
+			net_handoff(ctx, owner, slot);
+			goto retry;
+		}
+	}
+	#endif
 	uint32_t length = 0;
-	*session = ctx->onResolve(ctx->userptr, addr, raw, (uint32_t)raw_len, out, &length, userdata_out);
-	if(!*session)
-		goto retry;
-	if(!length) {
-		uprintf("Packet decryption failed\n");
+	uint8_t *payload = NULL;
+	*session = ctx->onResolve(ctx->userptr, addr, raw, raw_len, &payload, &length, userdata_out);
+	if(!*session || !length) {
+		#ifndef WINDOWS
+		if(!*session && ctx->shardGroup && slot->origin == NetOrigin_Socket && owner == NET_SHARD_NONE) { // may belong to a session pending on another shard; resolvers only decrypt in place once they've found a session, so `raw` is still intact
+			net_probe(ctx, slot);
+			goto retry;
+		}
+		#endif
+		if(*session && slot->origin != NetOrigin_Probe)
+			uprintf("Packet decryption failed\n");
 		goto retry;
 	}
 	if(*raw == 1) { // TODO: expose encryption state from `EncryptionState_decrypt`
 		if((*session)->alive)
-			(*session)->lastKeepAlive = net_time();
+			(*session)->lastKeepAlive = ctx->clock.ms;
 		while((*session)->mtu < length && (*session)->mtuIdx < lengthof(PossibleMtu) - 1)
 			net_set_mtu(*session, (*session)->mtuIdx + 1);
 	} else if(ctx->filterUnencrypted) {
 		goto retry;
 	}
+	#ifndef WINDOWS
+	if(ctx->shardGroup && !(*session)->steered) {
+		(*session)->steerKey = SS_key(&addr);
+		(*session)->steered = true;
+		NetShardGroup_steer(ctx->shardGroup, &(*session)->steerKey, ctx->shardIndex);
+	}
+	#endif
+	if(slot->arrival) {
+		net_count_delay(ctx->dispatchDelay, slot->arrival);
+		if(!ctx->pendingArrival)
+			ctx->pendingArrival = slot->arrival;
+	}
+	*out = payload;
 	return length;
 }
 void net_flush_merged(struct NetContext *ctx, struct NetSession *session) {
-	if(session->mergeData_end - session->mergeData > 3)
-		net_send_internal(ctx, session, session->mergeData, (uint32_t)(session->mergeData_end - session->mergeData), 1);
-	session->mergeData_end = session->mergeData;
-	pkt_write_c(&session->mergeData_end, endof(session->mergeData), session->version, NetPacketHeader, {
-		.property = PacketProperty_Merged,
-		.connectionNumber = 0,
-		.isFragmented = 0,
-	});
+	net_flush_merged_many(ctx, &session, 1);
 }
 void net_queue_merged(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint16_t len) {
 	if((session->mergeData_end - session->mergeData) + len + 2 > session->mtu)
 		net_flush_merged(ctx, session);
+	if(!session->dirtyPrev) {
+		#ifdef PERFTEST
+		session->mergeSince = GetTime_us();
+		#endif
+		session->dirtyNext = ctx->dirtySessions;
+		session->dirtyPrev = &ctx->dirtySessions;
+		if(ctx->dirtySessions)
+			ctx->dirtySessions->dirtyPrev = &session->dirtyNext;
+		ctx->dirtySessions = session;
+	}
 	pkt_write_c(&session->mergeData_end, endof(session->mergeData), session->version, MergedHeader, {
 		.length = len,
 	});
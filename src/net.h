@@ -25,6 +25,11 @@ typedef int socklen_t;
 
 #define NET_MAX_PKT_SIZE 1432
 #define NET_RESEND_DELAY 27
+#define NET_RECV_BATCH_DEFAULT 32
+#define NET_RECV_BATCH_MAX 1024
+#define NET_SEND_BATCH 64
+#define NET_SEND_MAX_WAIT 1 // milliseconds a queued datagram may be held back while the current pass is still running
+#define NET_PING_RATE_DEFAULT 1000 // ping replies per second across all senders
 
 #define NET_THREAD_INVALID 0 // TODO: this macro marks all non-portable uses of the pthreads API
 
@@ -38,7 +43,23 @@ struct SS {
 	};
 };
 
+struct NetClock { // CLOCK_MONOTONIC as sampled by the owning thread once per wakeup or receive batch, so handlers and fan-out loops never query it themselves
+	struct timespec mono;
+	uint32_t ms; // same scale as `net_time()`
+};
+
+static inline uint64_t NetClock_ticks(const struct NetClock *clock) { // 100ns units, as used by the LiteNetLib ping
+	return (uint64_t)clock->mono.tv_sec * UINT64_C(10000000) + (uint64_t)clock->mono.tv_nsec / UINT64_C(100);
+}
+
+struct NetAddrKey { // canonical form of an address, with IPv4 mapped into IPv6 and both fields in network byte order
+	uint8_t addr[16];
+	uint16_t port;
+};
+
 bool SS_equal(const struct SS *a0, const struct SS *a1);
+struct NetAddrKey SS_key(const struct SS *addr);
+uint32_t NetAddrKey_hash(const struct NetAddrKey *key); // FNV-1a
 void net_tostr(const struct SS *a, char out[static INET6_ADDRSTRLEN + 8]);
 int32_t net_bind_tcp(uint16_t port, uint32_t backlog);
 void net_close(int32_t sockfd);
@@ -49,29 +70,125 @@ struct NetKeypair {
 	mbedtls_ecp_point NET_H_PRIVATE(public);
 };
 
+struct NetShardGroup;
 struct NetSession {
 	struct NetKeypair keys;
 	struct PacketContext version;
 	struct Cookie32 clientRandom;
-	struct Cookie32 NET_H_PRIVATE(cookie);
 	struct EncryptionState NET_H_PRIVATE(encryptionState);
 	struct SS addr;
 	uint32_t lastKeepAlive;
 	uint16_t NET_H_PRIVATE(mtu);
 	uint8_t NET_H_PRIVATE(mtuIdx);
+	uint8_t NET_H_PRIVATE(mtuProbes); // MtuCheck probes for `PossibleMtu[mtuIdx + 1]` sent without an answer
+	bool NET_H_PRIVATE(gsoRefused); // the route to `addr` rejected a UDP_SEGMENT send; its datagrams are never merged
+	bool NET_H_PRIVATE(steered); // `steerKey` is registered with `shardGroup`
+	uint16_t NET_H_PRIVATE(shardIndex);
+	struct NetShardGroup *NET_H_PRIVATE(shardGroup);
+	struct NetAddrKey NET_H_PRIVATE(steerKey);
 	bool alive;
 	uint16_t maxChanneledSize, maxFragmentSize, fragmentId;
+	struct NetSession *NET_H_PRIVATE(dirtyNext), **NET_H_PRIVATE(dirtyPrev); // links in `NetContext.dirtySessions` while `mergeData` holds queued messages
+	uint64_t NET_H_PRIVATE(mergeSince); // `GetTime()` in microseconds when the first message was queued into `mergeData` (PERFTEST builds only)
 	uint8_t *NET_H_PRIVATE(mergeData_end);
 	uint8_t NET_H_PRIVATE(mergeData)[NET_MAX_PKT_SIZE];
 };
 
+struct NetRecvStats {
+	uint64_t batches; // receive calls which returned at least one datagram
+	uint64_t datagrams;
+	uint64_t full; // batches which filled every slot of the ring
+	uint64_t fill[11]; // histogram of datagrams per batch, bucketed by `floor(log2(n))`
+	uint64_t merged; // datagrams which arrived merged with others by UDP GRO
+};
+
+struct NetSendStats {
+	uint64_t flushes; // calls which submitted at least one datagram
+	uint64_t datagrams;
+	uint64_t errors; // datagrams rejected by the kernel
+	uint64_t segmented; // datagrams sent as segments of a UDP_SEGMENT (GSO) send
+	uint64_t gsoRefused; // segmented sends retried as plain datagrams after the route rejected them
+};
+
+struct NetMergeStats {
+	uint64_t flushes; // merged datagrams sent
+	uint64_t batchFlushes; // flushes triggered by draining a receive batch, rather than a full buffer or an explicit `net_flush_merged()`
+	uint64_t holdTime[16]; // histogram of microseconds between queueing the first message and sending, bucketed by `floor(log2(n))`
+};
+
+struct NetShardStats {
+	uint64_t handoffs; // datagrams forwarded to the shard owning their session
+	uint64_t probes; // unresolved datagrams offered to the other shards expecting their IP, or to all of them if none do
+	uint64_t limited; // unresolved datagrams offered to no shard: malformed, expected by this shard only, or beyond `NET_PROBE_RATE`
+	uint64_t received; // datagrams taken from this shard's inbox
+	uint64_t dropped; // datagrams lost to a full inbox
+};
+
+#define NET_LATENCY_BUCKETS 20
+
+// Queueing delay inside the server, starting from the kernel's receive timestamp. Histograms of microseconds, bucketed by `floor(log2(n))`.
+struct NetLatencyStats {
+	uint64_t dispatch[NET_LATENCY_BUCKETS]; // until `net_recv()` hands the datagram to its handler
+	uint64_t send[NET_LATENCY_BUCKETS]; // until the replies queued since the first datagram of a batch are passed to the kernel
+};
+
+struct NetSocketStats {
+	uint32_t drops; // datagrams the kernel dropped for lack of receive buffer space (SO_RXQ_OVFL)
+	uint32_t recvBuffer, sendBuffer; // SO_RCVBUF and SO_SNDBUF in bytes, as reported by the kernel
+	uint32_t tuned; // receive buffer resizes made by `net_autoTune`
+};
+
+struct NetPingStats {
+	uint64_t answered;
+	uint64_t limited; // dropped by the global or per-address rate limit
+	uint64_t stray; // non-ping datagrams which reached the dedicated ping socket
+};
+
+typedef uint8_t NetCommandType;
+enum NetCommandType {
+	NetCommandType_WireLink, // `onWireLink(from)`
+	NetCommandType_WireMessage, // `onWireMessage(from, &message)`
+	NetCommandType_WireDisconnect, // `onWireMessage(from, NULL)`
+	NetCommandType_Fence, // posted by `net_sync()` only
+};
+
+struct NetRecvRing;
+struct NetSendQueue;
+struct NetInbox;
+struct NetCommandQueue;
+struct NetPingResponder;
+struct NetPinger;
 struct NetContext {
 	WireLinkType _typeid; // used to distinguish between local (struct NetContext) and remote (mbedtls_ssl_context) connections
 	int32_t NET_H_PRIVATE(sockfd), NET_H_PRIVATE(listenfd);
+	int32_t NET_H_PRIVATE(pollfd); // epoll instance holding persistent registrations for `sockfd` (and the io_uring receiving from it), `listenfd`, and all `remoteLinks` (unused with `select()`)
 	atomic_bool NET_H_PRIVATE(run);
 	bool NET_H_PRIVATE(filterUnencrypted);
-	pthread_mutex_t NET_H_PRIVATE(mutex);
+	bool NET_H_PRIVATE(sockReady); // `sockfd` may still hold queued datagrams; cleared once a read would block
+	uint16_t NET_H_PRIVATE(drainBudget);
+	struct NetClock clock;
+	struct NetRecvRing *NET_H_PRIVATE(recvRing); // datagrams read from `sockfd` in the last batch, consumed by `net_recv()` before polling again
+	struct NetRecvStats recvStats;
+	struct NetSendQueue *NET_H_PRIVATE(sendQueue); // encrypted datagrams held until the current pass ends (see `net_unlock()`)
+	struct NetSendStats sendStats;
+	uint64_t NET_H_PRIVATE(pendingArrival); // receive timestamp of the first datagram handled since the last send, or 0
+	_Atomic uint64_t NET_H_PRIVATE(dispatchDelay)[NET_LATENCY_BUCKETS], NET_H_PRIVATE(sendDelay)[NET_LATENCY_BUCKETS]; // `struct NetLatencyStats`, read from other threads
+	_Atomic uint32_t NET_H_PRIVATE(sockDrops), NET_H_PRIVATE(sockRecvBuffer), NET_H_PRIVATE(sockSendBuffer), NET_H_PRIVATE(sockTuned); // `struct NetSocketStats`, read from other threads
+	uint32_t NET_H_PRIVATE(tuneDrops), NET_H_PRIVATE(tuneTime); // drop counter and time of the last `net_tune_buffers()` pass
+	struct NetSession *NET_H_PRIVATE(dirtySessions); // sessions with queued merged messages, flushed once the current receive batch is drained
+	struct NetMergeStats mergeStats;
+	uint32_t NET_H_PRIVATE(lockDepth); // nesting of `net_lock()` on the owning thread
+	bool NET_H_PRIVATE(owned);
+	pthread_t NET_H_PRIVATE(owner); // set by the first `net_lock()`; checked in debug builds
+	struct NetCommandQueue *NET_H_PRIVATE(commands); // work posted by other threads, run by the owner between datagrams
+	struct NetShardGroup *NET_H_PRIVATE(shardGroup); // set if `sockfd` is one of several SO_REUSEPORT sockets sharing a port
+	uint16_t NET_H_PRIVATE(shardIndex);
+	struct NetInbox *NET_H_PRIVATE(inbox); // datagrams handed off by other shards of `shardGroup`
+	struct NetShardStats shardStats;
+	struct NetPingResponder *NET_H_PRIVATE(pings); // answers pings which still arrive on `sockfd`
+	struct NetPinger *NET_H_PRIVATE(pinger); // answers pings steered to a socket of their own, without involving the owning thread
 	mbedtls_ctr_drbg_context ctr_drbg;
+	struct IvSource NET_H_PRIVATE(ivs); // CBC IVs for outbound datagrams, keyed from `ctr_drbg`
 	mbedtls_entropy_context NET_H_PRIVATE(entropy);
 	mbedtls_ecp_group NET_H_PRIVATE(grp);
 	uint32_t NET_H_PRIVATE(remoteLinks_len);
@@ -82,7 +199,7 @@ struct NetContext {
 	} NET_H_PRIVATE(remoteLinks);
 	struct WireCookie *NET_H_PRIVATE(cookies);
 	void *userptr;
-	struct NetSession *(*onResolve)(void *userptr, struct SS addr, const uint8_t packet[static 1536], uint32_t packet_len, uint8_t out[static 1536], uint32_t *out_len, void **userdata_out);
+	struct NetSession *(*onResolve)(void *userptr, struct SS addr, uint8_t *packet, uint32_t packet_len, uint8_t **out, uint32_t *out_len, void **userdata_out); // `*out` must point into `packet`, which the resolver may overwrite
 	uint32_t (*onResend)(void *userptr, uint32_t currentTime);
 	void (*onWireLink)(void *userptr, union WireLink *link);
 	void (*onWireMessage)(void *userptr, union WireLink *link, const struct WireMessage *message);
@@ -99,28 +216,49 @@ const struct Cookie32 *NetKeypair_get_random(const struct NetKeypair *keys);
 bool NetKeypair_write_key(const struct NetKeypair *keys, struct NetContext *ctx, struct ByteArrayNetSerializable *out);
 bool NetSession_signature(struct NetSession *session, struct NetContext *ctx, const mbedtls_pk_context *key, struct ByteArrayNetSerializable *out);
 
-const struct Cookie32 *NetSession_get_cookie(const struct NetSession *session);
 bool NetSession_set_remotePublicKey(struct NetSession *session, struct NetContext *ctx, const struct ByteArrayNetSerializable *in, bool client);
 uint32_t NetSession_get_lastKeepAlive(struct NetSession *session);
 const struct SS *NetSession_get_addr(struct NetSession *session);
 uint32_t NetSession_decrypt(struct NetSession *session, const uint8_t packet[static 1536], uint32_t packet_len, uint8_t out[static 1536]);
+uint32_t NetSession_decrypt_inplace(struct NetSession *session, uint8_t *packet, uint32_t packet_len, uint8_t **out);
 
 bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, uint32_t tcpBacklog);
+struct NetShardGroup *net_shard_group_new(uint32_t count);
+void net_shard_group_free(struct NetShardGroup *group);
+bool net_init_shard(struct NetContext *ctx, struct NetShardGroup *group, uint16_t port, bool filterUnencrypted, uint32_t tcpBacklog);
+void net_expect_ip(struct NetContext *ctx, const struct NetAddrKey *key, bool expect);
 void net_stop(struct NetContext *ctx);
 void net_cleanup(struct NetContext *ctx);
 void net_lock(struct NetContext *ctx);
 void net_unlock(struct NetContext *ctx);
 void NetSession_init(struct NetContext *ctx, struct NetSession *session, struct SS addr);
 void NetSession_free(struct NetSession *session);
+void NetSession_set_addr(struct NetSession *session, struct SS addr);
 bool net_add_remote(struct NetContext *ctx, mbedtls_ssl_context *link);
 bool net_remove_remote(struct NetContext *ctx, mbedtls_ssl_context *link);
-uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out);
+bool net_post(struct NetContext *ctx, NetCommandType type, union WireLink *from, const struct WireMessage *message);
+void net_sync(struct NetContext *ctx);
+uint32_t net_recv(struct NetContext *ctx, const uint8_t **out, struct NetSession **session, void **userdata_out); // `*out` points into the receive buffer and stays valid until the next call
 void net_flush_merged(struct NetContext *ctx, struct NetSession *session);
 void net_queue_merged(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint16_t len);
 void net_send_internal(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint32_t len, bool encrypt);
+void net_send_unconnected(struct NetContext *ctx, const struct SS *addr, const uint8_t *buf, uint32_t len);
+bool net_probe_mtu(struct NetContext *ctx, struct NetSession *session);
+void net_confirm_mtu(struct NetSession *session, uint32_t mtu);
 int32_t net_get_sockfd(struct NetContext *ctx);
 mbedtls_ctr_drbg_context *net_get_ctr_drbg(struct NetContext *ctx);
+void net_get_pingStats(const struct NetContext *ctx, struct NetPingStats *out);
+void net_get_latencyStats(const struct NetContext *ctx, struct NetLatencyStats *out);
+void net_get_socketStats(const struct NetContext *ctx, struct NetSocketStats *out);
 
 uint32_t net_time(void);
 
 extern bool net_useIPv4;
+extern bool net_useUring;
+extern bool net_useGro;
+extern uint16_t net_recvBatch;
+extern bool net_usePinger;
+extern uint16_t net_pingRate;
+extern uint32_t net_recvBuffer; // SO_RCVBUF in bytes for new sockets, or 0 for the kernel default
+extern uint32_t net_sendBuffer; // SO_SNDBUF in bytes for new sockets, or 0 for the kernel default
+extern bool net_autoTune; // grow the receive buffer when the kernel reports drops
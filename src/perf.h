@@ -19,14 +19,16 @@ struct Performance {
 	return ((uint64_t)to.tv_sec - (uint64_t)from.tv_sec) * UINT64_C(1000000000) + ((uint64_t)to.tv_nsec - (uint64_t)from.tv_nsec);
 }
 
-[[maybe_unused]] static void perf_tick(struct Performance *perf, struct timespec sleepStart, struct timespec sleepEnd) {
+// Returns `true` once per reporting interval
+[[maybe_unused]] static bool perf_tick(struct Performance *perf, struct timespec sleepStart, struct timespec sleepEnd) {
 	perf->frameSleep += DeltaNs(sleepStart, sleepEnd);
 	uint64_t frameTotal = DeltaNs(perf->frameStart, sleepEnd);
-	if(frameTotal >= UINT64_C(1000000000)) {
-		double load = (double)(frameTotal - perf->frameSleep) / (double)frameTotal;
-		perf->frameStart = sleepEnd;
-		perf->frameSleep = 0;
-		perf->load = (perf->load + load) / 2;
-		uprintf("load: %f (norm %f)\n", load, perf->load);
-	}
+	if(frameTotal < UINT64_C(1000000000))
+		return false;
+	double load = (double)(frameTotal - perf->frameSleep) / (double)frameTotal;
+	perf->frameStart = sleepEnd;
+	perf->frameSleep = 0;
+	perf->load = (perf->load + load) / 2;
+	uprintf("load: %f (norm %f)\n", load, perf->load);
+	return true;
 }
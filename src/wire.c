@@ -166,12 +166,10 @@ static bool wire_remote_handshake(struct NetContext *self, struct RemoteLink *li
 	return false;
 }
 
+// Local links belong to other threads; everything sent over them is posted to the owning thread of the receiving context
 union WireLink *wire_connect_local(struct NetContext *self, struct NetContext *link) {
-	if(!link->onWireLink)
+	if(!link->onWireLink || net_post(link, NetCommandType_WireLink, (union WireLink*)self, NULL))
 		return NULL;
-	net_lock(link);
-	link->onWireLink(link->userptr, (union WireLink*)self);
-	net_unlock(link);
 	return (union WireLink*)link;
 }
 
@@ -228,7 +226,7 @@ void wire_disconnect(struct NetContext *self, union WireLink *link) {
 		return;
 	self->onWireMessage(self->userptr, link, NULL);
 	if(link->type == WireLinkType_LOCAL) {
-		link->local.onWireMessage(link->local.userptr, (union WireLink*)self, NULL);
+		net_post(&link->local, NetCommandType_WireDisconnect, (union WireLink*)self, NULL);
 		return;
 	}
 	net_remove_remote(self, &link->remote.ctx);
@@ -246,16 +244,8 @@ void wire_disconnect(struct NetContext *self, union WireLink *link) {
 bool wire_send(struct NetContext *self, union WireLink *link, const struct WireMessage *message) {
 	if(link == NULL || link->type == WireLinkType_INVALID)
 		return true;
-	if(link->type == WireLinkType_LOCAL) {
-		uprintf("wire_send_local(%s)\n", reflect(WireMessageType, message->type));
-		net_lock(&link->local);
-		link->local.onWireMessage(link->local.userptr, (union WireLink*)self, message);
-		net_unlock(&link->local);
-		return false;
-	}
-	uprintf("wire_send(%s)\n", reflect(WireMessageType, message->type));
 	uint32_t cookie = message->cookie - 1;
-	if(cookie < self->cookies_len && self->cookies[cookie].length) {
+	if(cookie < self->cookies_len && self->cookies[cookie].length) { // the reply arrives after the caller's stack frame is gone, over either kind of link
 		void *buffer = malloc(self->cookies[cookie].length);
 		if(!buffer) {
 			uprintf("alloc error\n");
@@ -264,6 +254,11 @@ bool wire_send(struct NetContext *self, union WireLink *link, const struct WireM
 		memcpy(buffer, self->cookies[cookie].data, self->cookies[cookie].length);
 		self->cookies[cookie] = (struct WireCookie){buffer, 0};
 	}
+	if(link->type == WireLinkType_LOCAL) {
+		uprintf("wire_send_local(%s)\n", reflect(WireMessageType, message->type));
+		return net_post(&link->local, NetCommandType_WireMessage, (union WireLink*)self, message);
+	}
+	uprintf("wire_send(%s)\n", reflect(WireMessageType, message->type));
 	uint8_t pkt[16384], *pkt_end = pkt;
 	pkt_write(message, &pkt_end, endof(pkt), PV_LEGACY_DEFAULT);
 	for(int res = MBEDTLS_ERR_ERROR_CORRUPTION_DETECTED; (res = mbedtls_ssl_write(&link->remote.ctx, pkt, (size_t)(pkt_end - pkt))) <= 0;) {